@@ -1,10 +1,29 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 #include <limits.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <float.h>
+#include <math.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <lzma.h>
+#include <snappy-c.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <avro.h>
 #include <jansson.h>
 
@@ -14,9 +33,23 @@
     #define QUICKSTOP_CODEC  "null"
 #endif
 
+#define STDIO_NAME          "-"     // -d, -w and -r name for stdin or stdout
+
+#define AVRO_MAGIC          "Obj\x01"
+#define AVRO_MAGIC_SIZE     4
+#define AVRO_SYNC_SIZE      16
+
+#define INGEST_CHUNK_SIZE   (1024*1024)
+#define AUTO_CODEC_SAMPLE_SIZE  (4*1024*1024)
+#define CSV_READ_SIZE       (1024*1024)
+#define CSV_MAX_QUOTES      4
+#define CSV_BLOCK_SIZE      32
+#define POOL_JOBS_PER_THREAD    4
+
 #define RECORD_NAME_LEN     64
 #define FIELD_NAME_LEN      64
 #define TYPE_NAME_LEN       16
+#define LOGICAL_NAME_LEN    32
 
 #define TSDB_DATA_BOOL_NULL             0x02
 #define TSDB_DATA_TINYINT_NULL          0x80
@@ -29,12 +62,19 @@
 #define TSDB_DATA_UINT_NULL             0xFFFFFFFF
 #define TSDB_DATA_UBIGINT_NULL          0xFFFFFFFFFFFFFFFFL
 
+/* a record field as the read and write paths see it, built from the
+ * avro schema by recordschema_from_avro() */
 typedef struct FieldStruct_S {
     char name[FIELD_NAME_LEN];
-    char type[TYPE_NAME_LEN];
-    bool nullable;
+    char type[TYPE_NAME_LEN];       // of the value, the null branch aside
+    bool nullable;                  // a union of null and one other type
     bool is_array;
-    char array_type[TYPE_NAME_LEN];
+    char array_type[TYPE_NAME_LEN]; // array items or map values
+    char logical_type[LOGICAL_NAME_LEN];
+    int  precision;                 // of decimals
+    int  scale;
+    avro_schema_t schema;           // of the value, the null branch aside
+    struct RecordSchema_S *record;  // fields of a record value or items
 } FieldStruct;
 
 typedef struct RecordSchema_S {
@@ -43,6 +83,53 @@ typedef struct RecordSchema_S {
     int  num_fields;
 } RecordSchema;
 
+typedef enum {
+    CODEC_NULL = 0,
+    CODEC_DEFLATE,
+    CODEC_SNAPPY,
+    CODEC_LZMA,
+    CODEC_UNKNOWN
+} CodecType;
+
+static const char *g_codec_names[] = {
+    "null", "deflate", "snappy", "lzma"
+};
+
+static CodecType codec_from_name(const char *name)
+{
+    for (int i = 0; i < CODEC_UNKNOWN; i++) {
+        if (0 == strcmp(name, g_codec_names[i])) {
+            return i;
+        }
+    }
+    return CODEC_UNKNOWN;
+}
+
+/* what to do with a field that doesn't parse as its type */
+typedef enum OnErrorPolicy_E {
+    ON_ERROR_WARN,      // write the value libc would have made of it
+    ON_ERROR_FAIL,      // stop writing
+    ON_ERROR_SKIP,      // drop the row
+    ON_ERROR_NULL,      // write null, or drop the row if not nullable
+} OnErrorPolicy;
+
+static const char *g_on_error_names[] = {
+    "warn", "fail", "skip", "null"
+};
+
+/* how -r prints records */
+typedef enum OutputFormat_E {
+    FORMAT_TABLE,       // values followed by " |", for reading
+    FORMAT_CSV,
+    FORMAT_TSV,
+    FORMAT_JSONL,       // one json object per line
+    FORMAT_COLUMNAR,    // binary column buffers, see column_batch_write()
+} OutputFormat;
+
+static const char *g_format_names[] = {
+    "table", "csv", "tsv", "jsonl", "columnar"
+};
+
 typedef struct SArguments_S {
     bool read_file;
     char *read_filename;
@@ -53,6 +140,43 @@ typedef struct SArguments_S {
     char *json_filename;
     char *data_filename;
     bool debug_output;
+    int  threads;
+    char *quotes;
+    bool backslash_escape;
+    bool bench_csv;
+    OnErrorPolicy on_error;
+    char *codec;
+    int  level;
+    size_t block_size;
+    bool auto_codec;
+    double auto_codec_mbps;
+    OutputFormat format;
+    char *output_filename;
+    uint64_t batch_size;
+    char *fields;
+    char *where;
+    char *stats;
+    uint64_t offset;
+    bool inspect;
+    bool list_blocks;
+    bool append;
+    char *concat_filename;
+    char **concat_inputs;
+    int  num_concat_inputs;
+    char *split_filename;
+    int  split_parts;
+    bool split_by_records;
+    char *recompress_input;
+    char *recompress_output;
+    bool codec_given;
+    uint64_t bench_rows;
+    double bench_nulls;
+    int  bench_string_len;
+    int  bench_array_len;
+    bool verbose_print;
+    bool performance_print;
+    int  progress_interval;
+    bool generic_encode;
 } SArguments;
 
 SArguments g_args = {
@@ -65,6 +189,43 @@ SArguments g_args = {
     "",             // json_filename
     "",             // data_filename
     false,          // debug_output
+    1,              // threads
+    "\"'",           // quotes
+    false,          // backslash_escape
+    false,          // bench_csv
+    ON_ERROR_WARN,  // on_error
+    QUICKSTOP_CODEC,    // codec
+    -1,             // level
+    0,              // block_size
+    false,          // auto_codec
+    0,              // auto_codec_mbps
+    FORMAT_TABLE,   // format
+    "",             // output_filename
+    65536,          // batch_size
+    "",             // fields
+    "",             // where
+    "",             // stats
+    0,              // offset
+    false,          // inspect
+    false,          // list_blocks
+    false,          // append
+    "",             // concat_filename
+    NULL,           // concat_inputs
+    0,              // num_concat_inputs
+    "",             // split_filename
+    0,              // split_parts
+    false,          // split_by_records
+    "",             // recompress_input
+    "",             // recompress_output
+    false,          // codec_given
+    0,              // bench_rows
+    0.1,            // bench_nulls
+    16,             // bench_string_len
+    4,              // bench_array_len
+    false,          // verbose_print
+    false,          // performance_print
+    0,              // progress_interval
+    false,          // generic_encode
 };
 
 
@@ -102,9 +263,96 @@ SArguments g_args = {
   } while (0)
 
 
-static RecordSchema *parse_json_to_recordschema(json_t *element);
+/* phases timed with --perf, in seconds summed over the threads */
+typedef enum PerfPhase_E {
+    PERF_SCHEMA,
+    PERF_TOKENIZE,
+    PERF_BUILD,
+    PERF_ENCODE,        // with compression and writing in the serial writer
+    PERF_COMPRESS,
+    PERF_DECOMPRESS,
+    PERF_DECODE,        // with decompression in the serial reader
+    PERF_FORMAT,
+    PERF_WRITE,
+    PERF_NUM_PHASES
+} PerfPhase;
+
+static const char *g_perf_phase_names[] = {
+    "schema load", "csv tokenize", "value build", "encode", "compress",
+    "decompress", "decode", "format", "file write"
+};
+
+/* counted whether or not --perf is given, --progress prints them */
+typedef struct PerfCounters_S {
+    uint64_t    ns[PERF_NUM_PHASES];
+    uint64_t    rows;
+    uint64_t    errors;
+    uint64_t    bytes_in;       // csv read, or avro blocks read
+    uint64_t    bytes_out;      // avro blocks written, or records printed
+} PerfCounters;
+
+static PerfCounters g_perf;
+
+static uint64_t perf_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* start of a timed phase, 0 without --perf so nothing reads the clock */
+static inline uint64_t perf_now(void)
+{
+    return g_args.performance_print?perf_clock():0;
+}
+
+/* add the time since *t to phase, in times or else g_perf, and restart *t */
+static inline void perf_lap(uint64_t *times, PerfPhase phase, uint64_t *t)
+{
+    if (g_args.performance_print) {
+        uint64_t now = perf_clock();
+        if (times) {
+            times[phase] += now - *t;
+        } else {
+            __atomic_add_fetch(&g_perf.ns[phase], now - *t, __ATOMIC_RELAXED);
+        }
+        *t = now;
+    }
+}
+
+/* a worker sums its phases locally and adds them once per job */
+static void perf_add_times(uint64_t *times)
+{
+    for (int i = 0; g_args.performance_print && (i < PERF_NUM_PHASES); i++) {
+        if (times[i]) {
+            __atomic_add_fetch(&g_perf.ns[i], times[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void perf_count(uint64_t rows, uint64_t errors,
+        uint64_t bytes_in, uint64_t bytes_out)
+{
+    __atomic_add_fetch(&g_perf.rows, rows, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_perf.errors, errors, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_perf.bytes_in, bytes_in, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_perf.bytes_out, bytes_out, __ATOMIC_RELAXED);
+}
+
 static void print_json_aux(json_t *element, int indent);
 
+static bool is_stdio(const char *filename)
+{
+    return 0 == strcmp(filename, STDIO_NAME);
+}
+
+/* reports of the write path go to stderr when stdout carries the avro data */
+static FILE *report_stream(void)
+{
+    return is_stdio(g_args.write_filename)?stderr:stdout;
+}
+
 static void printHelp()
 {
     char indent[10] = "        ";
@@ -113,17 +361,83 @@ static void printHelp()
 
     printf("%s\n\n", "avrotool usage:");
     printf("%s%s%s%s\n", indent, "-r\t", indent,
-            "<avro filename>. print avro file's contents including schema and data.");
+            "<avro filename>. print avro file's contents including schema and data, - for stdin.");
     printf("%s%s%s%s\n", indent, "-c\t", indent,
             "<count>. specify number of avro data to print.");
+    printf("%s%s%s%s\n", indent, "--offset", indent,
+            "<n>. start printing at record n, counted from 0, seeking by the block index.");
+    printf("%s%s%s%s\n", indent, "--range", indent,
+            "<from>:<to>. print records from up to, not including, to.");
+    printf("%s%s%s%s\n", indent, "--fields", indent,
+            "<name,name,...>. read only these fields, in this order.");
+    printf("%s%s%s%s\n", indent, "--where", indent,
+            "<expression>. print only the records matching it, see README.");
+    printf("%s%s%s%s\n", indent, "--format", indent,
+            "<table|csv|tsv|jsonl|columnar>. format of the records printed with -r, default is table.");
+    printf("%s%s%s%s\n", indent, "--batch-size", indent,
+            "<rows>. records per batch of the columnar format, default is 65536.");
+    printf("%s%s%s%s\n", indent, "-o\t", indent,
+            "<filename>. write the records printed with -r to a file instead of stdout.");
     printf("%s%s%s%s\n", indent, "-s\t", indent,
             "<avro filename>. print avro schema only.");
+    printf("%s%s%s%s\n", indent, "-i\t", indent,
+            "<avro filename>. print record, block and byte counts from the block headers only.");
+    printf("%s%s%s%s\n", indent, "--concat", indent,
+            "<output> <input> <input> ... copy the blocks of avro files with one schema and codec into one.");
+    printf("%s%s%s%s\n", indent, "--split", indent,
+            "<avro filename>. copy the blocks of the file into --parts files of about equal size.");
+    printf("%s%s%s%s\n", indent, "--parts", indent,
+            "<n>. number of files --split writes, named after -o or the input with .0.avro, .1.avro ...");
+    printf("%s%s%s%s\n", indent, "--split-by", indent,
+            "<bytes|records>. what the parts of --split are equal in, default is bytes.");
+    printf("%s%s%s%s\n", indent, "--recompress", indent,
+            "<input> <output>. write the avro file again with --codec, required, and --level, block by block.");
+    printf("%s%s%s%s\n", indent, "--blocks", indent,
+            "with -i, also print the offset, records and bytes of every block.");
     printf("%s%s%s%s\n", indent, "-w\t", indent,
-            "<avro filename>. specify avro filename to write.");
+            "<avro filename>. specify avro filename to write, - for stdout.");
+    printf("%s%s%s%s\n", indent, "--append", indent,
+            "add the records to the file given by -w if it exists, it keeps its codec.");
     printf("%s%s%s%s\n", indent, "-m\t", indent,
             "<json filename>. use json as schema to write data to avro file.");
     printf("%s%s%s%s\n", indent, "-d\t", indent,
-            "<data filename>. use csv file as input data.");
+            "<data filename>. use csv file as input data, - for stdin.");
+    printf("%s%s%s%s\n", indent, "-j\t", indent,
+            "<threads>. number of threads to encode or decode data with, 0 for all cpus.");
+    printf("%s%s%s%s\n", indent, "--quote", indent,
+            "<chars>. quote characters of csv fields, default is \"'. empty to disable.");
+    printf("%s%s%s%s\n", indent, "--escape", indent,
+            "<double|backslash>. escape of quotes inside quoted fields, default is double.");
+    printf("%s%s%s%s\n", indent, "--codec", indent,
+            "<null|deflate|snappy|lzma>. codec of the avro file to write, default is "QUICKSTOP_CODEC".");
+    printf("%s%s%s%s\n", indent, "--level", indent,
+            "<0-9>. compression level of deflate or lzma.");
+    printf("%s%s%s%s\n", indent, "--block-size", indent,
+            "<bytes>. uncompressed size of each block, k and m suffixes are allowed.");
+    printf("%s%s%s%s\n", indent, "--stats", indent,
+            "<name,name,...>. keep min and max of these fields per block for --where.");
+    printf("%s%s%s%s\n", indent, "--auto-codec", indent,
+            "<MB/s>. pick the codec and block size giving the smallest file at this speed per thread.");
+    printf("%s%s%s%s\n", indent, "--on-error", indent,
+            "<warn|fail|skip|null>. policy for fields that don't parse, default is warn.");
+    printf("%s%s%s%s\n", indent, "--bench-csv", indent,
+            "benchmark csv tokenizers on the data file given with -d.");
+    printf("%s%s%s%s\n", indent, "--bench", indent,
+            "<rows>. write and read this many rows made up for the schema given by -m, per codec and block size.");
+    printf("%s%s%s%s\n", indent, "--bench-nulls", indent,
+            "<ratio>. share of null values in nullable fields of --bench, default is 0.1.");
+    printf("%s%s%s%s\n", indent, "--bench-string-len", indent,
+            "<chars>. average length of strings and bytes of --bench, default is 16.");
+    printf("%s%s%s%s\n", indent, "--bench-array-len", indent,
+            "<items>. average number of items in arrays and maps of --bench, default is 4.");
+    printf("%s%s%s%s\n", indent, "--perf", indent,
+            "print the time of each phase, rows, bytes, errors and peak memory to stderr.");
+    printf("%s%s%s%s\n", indent, "--progress", indent,
+            "<seconds>. with --perf, print the rows and bytes so far at this interval.");
+    printf("%s%s%s%s\n", indent, "--verbose", indent,
+            "print how the file is read or written.");
+    printf("%s%s%s%s\n", indent, "--generic-encode", indent,
+            "build an avro value per row even for schemas the direct encoder writes.");
     printf("%s%s%s%s\n", indent, "-g\t", indent,
             "print debug info.");
     printf("%s%s%s%s\n", indent, "--help\t", indent,
@@ -147,6 +461,26 @@ static bool isStringNumber(char *input)
     return true;
 }
 
+/* a byte count with an optional k or m suffix */
+static bool parse_size(const char *input, size_t *size)
+{
+    char *eptr;
+    unsigned long long n = strtoull(input, &eptr, 10);
+
+    if ((eptr == input) || (!isdigit(input[0]))) {
+        return false;
+    }
+    if (('k' == *eptr) || ('K' == *eptr)) {
+        n *= 1024;
+        eptr ++;
+    } else if (('m' == *eptr) || ('M' == *eptr)) {
+        n *= 1024 * 1024;
+        eptr ++;
+    }
+    *size = n;
+    return ('\0' == *eptr) && (n > 0);
+}
+
 static bool parse_args(int argc, char *argv[], SArguments *arguments)
 {
     bool has_flags = true;
@@ -158,10 +492,84 @@ static bool parse_args(int argc, char *argv[], SArguments *arguments)
         } else if (strcmp(argv[i], "-s") == 0) {
             arguments->schema_only = true;
             arguments->read_filename = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0) {
+            arguments->inspect = true;
+            arguments->read_filename = argv[++i];
+        } else if (strcmp(argv[i], "--blocks") == 0) {
+            arguments->list_blocks = true;
+        } else if (strcmp(argv[i], "--append") == 0) {
+            arguments->append = true;
+        } else if (strcmp(argv[i], "--split") == 0) {
+            if (i + 1 < argc) {
+                arguments->split_filename = argv[++i];
+            } else {
+                errorPrint("%s", "--split needs an avro file\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--parts") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1]) && (atoi(argv[i+1]) > 0)) {
+                arguments->split_parts = atoi(argv[++i]);
+            } else {
+                errorPrint("%s", "--parts needs a number of files\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--split-by") == 0) {
+            if ((i + 1 < argc) && ((0 == strcmp(argv[i+1], "bytes"))
+                        || (0 == strcmp(argv[i+1], "records")))) {
+                arguments->split_by_records = (0 == strcmp(argv[++i], "records"));
+            } else {
+                errorPrint("%s", "--split-by needs bytes or records\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--recompress") == 0) {
+            if (i + 2 < argc) {
+                arguments->recompress_input = argv[++i];
+                arguments->recompress_output = argv[++i];
+            } else {
+                errorPrint("%s", "--recompress needs the input and the output avro files\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--concat") == 0) {
+            if (i + 1 < argc) {
+                arguments->concat_filename = argv[++i];
+                arguments->concat_inputs = &argv[i + 1];
+                while ((i + 1 < argc) && ('-' != argv[i+1][0])) {
+                    arguments->num_concat_inputs ++;
+                    i ++;
+                }
+            }
+            if (0 == arguments->num_concat_inputs) {
+                errorPrint("%s", "--concat needs the output and the input avro files\n");
+                has_flags = false;
+            }
         } else if (strcmp(argv[i], "-c") == 0) {
             if (isStringNumber(argv[i+1])) {
                 arguments->count = atoi(argv[++i]);
             }
+        } else if (strcmp(argv[i], "--offset") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1])) {
+                arguments->offset = strtoull(argv[++i], NULL, 10);
+            } else {
+                errorPrint("%s", "--offset needs a record number\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--range") == 0) {
+            char *eptr = NULL;
+            uint64_t from = 0, to = 0;
+            if ((i + 1 < argc) && isdigit((unsigned char)argv[i+1][0])) {
+                from = strtoull(argv[i+1], &eptr, 10);
+                if ((':' == *eptr) && isdigit((unsigned char)eptr[1])) {
+                    to = strtoull(eptr + 1, &eptr, 10);
+                }
+            }
+            if ((NULL != eptr) && ('\0' == *eptr) && (to > from)) {
+                arguments->offset = from;
+                arguments->count = to - from;
+                i ++;
+            } else {
+                errorPrint("%s", "--range needs from:to with to above from\n");
+                has_flags = false;
+            }
         } else if (strcmp(argv[i], "-w") == 0) {
             arguments->write_file = true;
             arguments->write_filename = argv[++i];
@@ -169,6 +577,192 @@ static bool parse_args(int argc, char *argv[], SArguments *arguments)
             arguments->json_filename = argv[++i];
         } else if (strcmp(argv[i], "-d") == 0) {
             arguments->data_filename = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1])) {
+                arguments->threads = atoi(argv[++i]);
+                if (0 == arguments->threads) {
+                    arguments->threads = sysconf(_SC_NPROCESSORS_ONLN);
+                }
+            } else {
+                errorPrint("%s", "-j needs a number of threads\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--quote") == 0) {
+            if ((i + 1 < argc) && (strlen(argv[i+1]) <= CSV_MAX_QUOTES)) {
+                arguments->quotes = argv[++i];
+            } else {
+                errorPrint("--quote needs at most %d characters\n", CSV_MAX_QUOTES);
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--escape") == 0) {
+            if ((i + 1 < argc) && (0 == strcmp(argv[i+1], "double"))) {
+                arguments->backslash_escape = false;
+                i ++;
+            } else if ((i + 1 < argc) && (0 == strcmp(argv[i+1], "backslash"))) {
+                arguments->backslash_escape = true;
+                i ++;
+            } else {
+                errorPrint("%s", "--escape needs double or backslash\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--codec") == 0) {
+            if ((i + 1 < argc) && (CODEC_UNKNOWN != codec_from_name(argv[i+1]))) {
+                arguments->codec = argv[++i];
+                arguments->codec_given = true;
+            } else {
+                errorPrint("%s", "--codec needs null, deflate, snappy or lzma\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--level") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1])
+                    && (atoi(argv[i+1]) <= 9)) {
+                arguments->level = atoi(argv[++i]);
+            } else {
+                errorPrint("%s", "--level needs a number from 0 to 9\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--block-size") == 0) {
+            if ((i + 1 < argc) && parse_size(argv[i+1], &arguments->block_size)) {
+                i ++;
+            } else {
+                errorPrint("%s", "--block-size needs a size in bytes\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--auto-codec") == 0) {
+            char *eptr = NULL;
+            if (i + 1 < argc) {
+                arguments->auto_codec_mbps = strtod(argv[i+1], &eptr);
+            }
+            if ((NULL != eptr) && (eptr != argv[i+1]) && ('\0' == *eptr)
+                    && (arguments->auto_codec_mbps >= 0)) {
+                arguments->auto_codec = true;
+                i ++;
+            } else {
+                errorPrint("%s", "--auto-codec needs a speed in MB/s\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--on-error") == 0) {
+            int p = 0;
+            int num = sizeof(g_on_error_names) / sizeof(g_on_error_names[0]);
+
+            if (i + 1 < argc) {
+                for (p = 0; p < num; p++) {
+                    if (0 == strcmp(argv[i+1], g_on_error_names[p])) {
+                        break;
+                    }
+                }
+            }
+            if ((i + 1 < argc) && (p < num)) {
+                arguments->on_error = p;
+                i ++;
+            } else {
+                errorPrint("%s", "--on-error needs warn, fail, skip or null\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--format") == 0) {
+            int f = 0;
+            int num = sizeof(g_format_names) / sizeof(g_format_names[0]);
+
+            if (i + 1 < argc) {
+                for (f = 0; f < num; f++) {
+                    if (0 == strcmp(argv[i+1], g_format_names[f])) {
+                        break;
+                    }
+                }
+            }
+            if ((i + 1 < argc) && (f < num)) {
+                arguments->format = f;
+                i ++;
+            } else {
+                errorPrint("%s", "--format needs table, csv, tsv, jsonl or columnar\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--fields") == 0) {
+            if (i + 1 < argc) {
+                arguments->fields = argv[++i];
+            } else {
+                errorPrint("%s", "--fields needs a list of field names\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--where") == 0) {
+            if (i + 1 < argc) {
+                arguments->where = argv[++i];
+            } else {
+                errorPrint("%s", "--where needs an expression\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            if (i + 1 < argc) {
+                arguments->stats = argv[++i];
+            } else {
+                errorPrint("%s", "--stats needs a list of field names\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--batch-size") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1])
+                    && (strtoull(argv[i+1], NULL, 10) > 0)) {
+                arguments->batch_size = strtoull(argv[++i], NULL, 10);
+            } else {
+                errorPrint("%s", "--batch-size needs a number of records\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (i + 1 < argc) {
+                arguments->output_filename = argv[++i];
+            } else {
+                errorPrint("%s", "-o needs a filename\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--bench-csv") == 0) {
+            arguments->bench_csv = true;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1])
+                    && (strtoull(argv[i+1], NULL, 10) > 0)) {
+                arguments->bench_rows = strtoull(argv[++i], NULL, 10);
+            } else {
+                errorPrint("%s", "--bench needs a number of rows\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--bench-nulls") == 0) {
+            char *eptr = NULL;
+            if (i + 1 < argc) {
+                arguments->bench_nulls = strtod(argv[i+1], &eptr);
+            }
+            if ((NULL != eptr) && (eptr != argv[i+1]) && ('\0' == *eptr)
+                    && (arguments->bench_nulls >= 0) && (arguments->bench_nulls <= 1)) {
+                i ++;
+            } else {
+                errorPrint("%s", "--bench-nulls needs a ratio from 0 to 1\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--bench-string-len") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1]) && (atoi(argv[i+1]) > 0)) {
+                arguments->bench_string_len = atoi(argv[++i]);
+            } else {
+                errorPrint("%s", "--bench-string-len needs a number of characters\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--bench-array-len") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1])) {
+                arguments->bench_array_len = atoi(argv[++i]);
+            } else {
+                errorPrint("%s", "--bench-array-len needs a number of items\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            arguments->performance_print = true;
+        } else if (strcmp(argv[i], "--progress") == 0) {
+            if ((i + 1 < argc) && isStringNumber(argv[i+1]) && (atoi(argv[i+1]) > 0)) {
+                arguments->progress_interval = atoi(argv[++i]);
+                arguments->performance_print = true;
+            } else {
+                errorPrint("%s", "--progress needs a number of seconds\n");
+                has_flags = false;
+            }
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            arguments->verbose_print = true;
+        } else if (strcmp(argv[i], "--generic-encode") == 0) {
+            arguments->generic_encode = true;
         } else if (strcmp(argv[i], "-g") == 0) {
             arguments->debug_output = true;
         } else if (strcmp(argv[i], "--help") == 0) {
@@ -298,741 +892,7945 @@ static void print_json_aux(json_t *element, int indent)
 
 static void print_json(json_t *root) { print_json_aux(root, 0); }
 
-static json_t *load_json(char *jsonbuf)
-{
-    json_t *root;
-    json_error_t error;
-
-    root = json_loads(jsonbuf, 0, &error);
-
-    if (root) {
-        return root;
-    } else {
-        errorPrint("json error on line %d: %s\n", error.line, error.text);
-        return NULL;
-    }
-}
 
 static void freeRecordSchema(RecordSchema *recordSchema)
 {
     if (recordSchema) {
         if (recordSchema->fields) {
+            for (int i = 0; i < recordSchema->num_fields; i++) {
+                FieldStruct *field = (FieldStruct *)
+                    (recordSchema->fields + sizeof(FieldStruct) * i);
+                freeRecordSchema(field->record);
+            }
             free(recordSchema->fields);
         }
         free(recordSchema);
     }
 }
 
-static int read_avro_file()
+static avro_schema_t resolve_link(avro_schema_t schema)
 {
-    avro_file_reader_t reader;
-    avro_writer_t stdout_writer = avro_writer_file_fp(stdout, 1);
-
-    avro_schema_t schema;
-    avro_datum_t record;
-    char *json=NULL;
+    while (AVRO_LINK == avro_typeof(schema)) {
+        schema = avro_schema_link_target(schema);
+    }
+    return schema;
+}
 
-    if(avro_file_reader(g_args.read_filename, &reader)) {
-        errorPrint("Unable to open avro file %s: %s\n",
-                g_args.read_filename, avro_strerror());
-        return -1;
+static const char *avro_type_to_name(avro_schema_t schema)
+{
+    switch (avro_typeof(resolve_link(schema))) {
+        case AVRO_STRING:   return "string";
+        case AVRO_BYTES:    return "bytes";
+        case AVRO_INT32:    return "int";
+        case AVRO_INT64:    return "long";
+        case AVRO_FLOAT:    return "float";
+        case AVRO_DOUBLE:   return "double";
+        case AVRO_BOOLEAN:  return "boolean";
+        case AVRO_NULL:     return "null";
+        case AVRO_RECORD:   return "record";
+        case AVRO_ENUM:     return "enum";
+        case AVRO_FIXED:    return "fixed";
+        case AVRO_MAP:      return "map";
+        case AVRO_ARRAY:    return "array";
+        case AVRO_UNION:    return "union";
+        default:            return "unknown";
     }
-    schema = avro_file_reader_get_writer_schema(reader);
-    printf("=== Schema:\n");
-    avro_schema_to_json(schema, stdout_writer);
-    printf("\n");
+}
 
-    FILE *jsonfile = fopen("jsonfile.json", "w+");
-    avro_writer_t jsonfile_writer;
-    json_t *json_root = NULL;
-    RecordSchema *recordSchema = NULL;
+static RecordSchema *recordschema_from_avro(avro_schema_t schema, json_t *json);
 
-    debugPrint("%s() LN%d reocrdschema=%p\n",
-            __func__, __LINE__, recordSchema);
-    if (jsonfile) {
-        jsonfile_writer = avro_writer_file_fp(jsonfile, 0);
-        avro_schema_to_json(schema, jsonfile_writer);
+/* Fill the type of a field from its avro schema. json is the field's
+ * "type" in the schema text, used for logicalType, precision and scale
+ * which avro's schema parser drops. It's NULL when not known. */
+static int fill_field_type(FieldStruct *field, avro_schema_t schema, json_t *json)
+{
+    /* a link names a type defined elsewhere, maybe an enclosing record,
+     * so its fields are not expanded again */
+    bool linked = (AVRO_LINK == avro_typeof(schema));
 
-        fseek(jsonfile, 0, SEEK_END);
-        int size = ftell(jsonfile);
+    if (linked) {
+        schema = resolve_link(schema);
+        json = NULL;
+    }
 
-        char *jsonbuf = calloc(size + 1, 1);
-        assert(jsonbuf);
-        fseek(jsonfile, 0, SEEK_SET);
-        fread(jsonbuf, 1, size, jsonfile);
+    if (is_avro_union(schema)) {
+        size_t branches = avro_schema_union_size(schema);
+        int null_branch = -1;
+        int value_branch = -1;
+        int values = 0;
 
-        json_root = load_json(jsonbuf);
-        if (g_args.debug_output) {
-            printf("\n%s() LN%d\n === Schema parsed:\n", __func__, __LINE__);
-            print_json(json_root);
+        for (size_t b = 0; b < branches; b++) {
+            if (is_avro_null(avro_schema_union_branch(schema, b))) {
+                null_branch = b;
+            } else {
+                value_branch = b;
+                values ++;
+            }
         }
 
-        recordSchema = parse_json_to_recordschema(json_root);
-        if (NULL == recordSchema) {
-            fclose(jsonfile);
-            errorPrint("%s", "Failed to parse json to recordschema\n");
-            exit(EXIT_FAILURE);
+        if ((null_branch >= 0) && (1 == values)) {
+            field->nullable = true;
+            json = json_is_array(json)?json_array_get(json, value_branch):NULL;
+            return fill_field_type(field,
+                    avro_schema_union_branch(schema, value_branch), json);
         }
+    }
 
-        json_decref(json_root);
-        free(jsonbuf);
-        fclose(jsonfile);
+    field->schema = schema;
+    tstrncpy(field->type, avro_type_to_name(schema), TYPE_NAME_LEN-1);
+
+    if (json_is_object(json)) {
+        json_t *logical = json_object_get(json, "logicalType");
+        if (json_is_string(logical)) {
+            tstrncpy(field->logical_type, json_string_value(logical),
+                    LOGICAL_NAME_LEN-1);
+            field->precision = json_integer_value(
+                    json_object_get(json, "precision"));
+            field->scale = json_integer_value(json_object_get(json, "scale"));
+        }
     }
 
-    uint64_t count = 0;
+    avro_schema_t nested = NULL;
+    json_t *nested_json = NULL;
 
-    if (false == g_args.schema_only) {
-        printf("\n=== Records:\n");
-        avro_value_iface_t *value_class = avro_generic_class_from_schema(schema);
-        avro_value_t value;
-        avro_generic_value_new(value_class, &value);
+    switch (avro_typeof(schema)) {
+        case AVRO_ARRAY:
+            field->is_array = true;
+            nested = avro_schema_array_items(schema);
+            nested_json = json_object_get(json, "items");
+            break;
 
-        while(!avro_file_reader_read_value(reader, &value)) {
-            for (int i = 0; i < recordSchema->num_fields; i++) {
-                FieldStruct *field = (FieldStruct *)(recordSchema->fields + sizeof(FieldStruct) * i);
-                avro_value_t field_value;
-                int32_t n32;
-                float f;
-                double dbl;
-                int64_t n64;
-                int b;
-                const char *buf = NULL;
-                size_t size;
-                const void *bytesbuf = NULL;
-                size_t bytessize;
-                if (0 == avro_value_get_by_name(&value, field->name, &field_value, NULL)) {
-                    if (0 == strcmp(field->type, "int")) {
-                        if (field->nullable) {
-                            avro_value_t branch;
-                            avro_value_get_current_branch(&field_value,
-                                    &branch);
-                            if (0 == avro_value_get_null(&branch)) {
-                                printf("%s |\t", "null");
-                            } else {
-                                avro_value_get_int(&branch, &n32);
-                                printf("%d |\t", n32);
-                            }
-                        } else {
-                            avro_value_get_int(&field_value, &n32);
-                            if (((int32_t)TSDB_DATA_INT_NULL == n32)
-                                    || (TSDB_DATA_SMALLINT_NULL == n32)
-                                    || (TSDB_DATA_TINYINT_NULL == n32)) {
-                                fprintf(stdout, "%s |\t", "null?");
-                            } else {
-                                printf("%d |\t", n32);
-                            }
-                        }
-                    } else if (0 == strcmp(field->type, "float")) {
-                        if (field->nullable) {
-                            avro_value_t branch;
-                            avro_value_get_current_branch(&field_value,
-                                    &branch);
-                            if (0 == avro_value_get_null(&branch)) {
-                                printf("%s |\t", "null");
-                            } else {
-                                avro_value_get_float(&branch, &f);
-                                printf("%f |\t", f);
-                            }
-                        } else {
-                            avro_value_get_float(&field_value, &f);
-                            printf("%f |\t", f);
-                        }
-                    } else if (0 == strcmp(field->type, "double")) {
-                        avro_value_get_double(&field_value, &dbl);
-                        printf("%f |\t", dbl);
-                    } else if (0 == strcmp(field->type, "long")) {
-                        if (field->nullable) {
-                            avro_value_t branch;
-                            avro_value_get_current_branch(&field_value,
-                                    &branch);
-                            if (0 == avro_value_get_null(&branch)) {
-                                printf("%s |\t", "null");
-                            } else {
-                                avro_value_get_long(&branch, &n64);
-                                printf("%"PRId64" |\t", n64);
-                            }
-                        } else {
-                            avro_value_get_long(&field_value, &n64);
-                            if ((int64_t)TSDB_DATA_BIGINT_NULL == n64) {
-                                fprintf(stdout, "%s |\t", "null");
-                            } else {
-                                printf("%"PRId64" |\t", n64);
-                            }
-                        }
-                    } else if (0 == strcmp(field->type, "string")) {
-                        if (field->nullable) {
-                            avro_value_t branch;
-                            avro_value_get_current_branch(&field_value,
-                                    &branch);
-                            avro_value_get_string(&branch, &buf, &size);
-                        } else {
-                            avro_value_get_string(&field_value, &buf, &size);
-                        }
-                        printf("%s |\t", buf);
-                    } else if (0 == strcmp(field->type, "bytes")) {
-                        if (field->nullable) {
-                            avro_value_t branch;
-                            avro_value_get_current_branch(&field_value,
-                                    &branch);
-                            avro_value_get_bytes(&branch, &bytesbuf,
-                                    &bytessize);
-                        } else {
-                            avro_value_get_bytes(&field_value, &bytesbuf,
-                                    &bytessize);
-                        }
-                        printf("%s |\t", (char*)bytesbuf);
-                    } else if (0 == strcmp(field->type, "boolean")) {
-                        if (field->nullable) {
-                            avro_value_t bool_branch;
-                            avro_value_get_current_branch(&field_value,
-                                    &bool_branch);
-                            if (0 == avro_value_get_null(&bool_branch)) {
-                                printf("%s |\t", "null");
-                            } else {
-                                avro_value_get_boolean(&bool_branch, &b);
-                                printf("%s |\t", b?"true":"false");
-                            }
-                        } else {
-                            avro_value_get_boolean(&field_value, &b);
-                            printf("%s |\t", b?"true":"false");
-                        }
-                    } else if (0 == strcmp(field->type, "array")) {
-                        if (field->nullable) {
-                            avro_value_t arr_branch;
-                            avro_value_get_current_branch(&field_value,
-                                    &arr_branch);
-                            if (0 == avro_value_get_null(&arr_branch)) {
-                                printf("%s |\t", "null");
-                            } else {
-                                size_t array_size;
-                                avro_value_get_size(&arr_branch, &array_size);
-
-                                debugPrint("array_size is %d\n", (int) array_size);
-                                if (0 == strcmp(field->array_type, "int")) {
-                                    uint32_t array_u32 = 0;
-                                    for (size_t item = 0; item < array_size; item ++) {
-                                        avro_value_t item_value;
-                                        avro_value_get_by_index(&arr_branch, item,
-                                                &item_value, NULL);
-                                        avro_value_get_int(&item_value, &n32);
-                                        array_u32 += n32;
-                                    }
-                                    printf("%u |\t", array_u32);
-                                } else if (0 == strcmp(field->array_type, "long")) {
-                                    uint64_t array_u64 = 0;
-                                    for (size_t item = 0; item < array_size; item ++) {
-                                        avro_value_t item_value;
-                                        avro_value_get_by_index(&arr_branch, item,
-                                                &item_value, NULL);
-                                        avro_value_get_long(&item_value, &n64);
-                                        array_u64 += n64;
-                                    }
-                                    printf("%"PRIu64" |\t", array_u64);
-                                } else {
-                                    errorPrint("%s is not supported!\n",
-                                            field->array_type);
-                                }
-                            }
-                        } else {
-                            size_t array_size;
-                            avro_value_get_size(&field_value, &array_size);
-
-                            debugPrint("array_size is %d\n", (int) array_size);
-                            if (0 == strcmp(field->array_type, "int")) {
-                                uint32_t array_u32 = 0;
-                                for (size_t item = 0; item < array_size; item ++) {
-                                    avro_value_t item_value;
-                                    avro_value_get_by_index(&field_value, item,
-                                            &item_value, NULL);
-                                    avro_value_get_int(&item_value, &n32);
-                                    array_u32 += n32;
-                                }
-                                if ((TSDB_DATA_UINT_NULL == array_u32)
-                                        || (TSDB_DATA_USMALLINT_NULL == array_u32)
-                                        || (TSDB_DATA_UTINYINT_NULL == array_u32)) {
-                                    fprintf(stdout, "%s |\t", "null?");
-                                } else {
-                                    printf("%u |\t", array_u32);
-                                }
-                            } else if (0 == strcmp(field->array_type, "long")) {
-                                uint64_t array_u64 = 0;
-                                for (size_t item = 0; item < array_size; item ++) {
-                                    avro_value_t item_value;
-                                    avro_value_get_by_index(&field_value, item,
-                                            &item_value, NULL);
-                                    avro_value_get_long(&item_value, &n64);
-                                    array_u64 += n64;
-                                }
-                                if (TSDB_DATA_UBIGINT_NULL == array_u64) {
-                                    fprintf(stdout, "%s |\t", "null?");
-                                } else {
-                                    printf("%"PRIu64" |\t", array_u64);
-                                }
-                            } else {
-                                errorPrint("%s is not supported!\n",
-                                        field->array_type);
-                            }
-                        }
-                    }
+        case AVRO_MAP:
+            nested = avro_schema_map_values(schema);
+            nested_json = json_object_get(json, "values");
+            break;
+
+        case AVRO_RECORD:
+            if (!linked) {
+                field->record = recordschema_from_avro(schema, json);
+                if (NULL == field->record) {
+                    return -1;
                 }
             }
-            printf("\n");
+            break;
 
-            count ++;
-            if (count == g_args.count) {
-                break;
+        default:
+            break;
+    }
+
+    if (nested) {
+        tstrncpy(field->array_type, avro_type_to_name(nested), TYPE_NAME_LEN-1);
+        if (is_avro_record(nested)) {
+            field->record = recordschema_from_avro(nested, nested_json);
+            if (NULL == field->record) {
+                return -1;
             }
         }
-
-        avro_value_decref(&value);
-        avro_value_iface_decref(value_class);
     }
 
-    freeRecordSchema(recordSchema);
-    avro_schema_decref(schema);
-    avro_file_reader_close(reader);
-    avro_writer_free(stdout_writer);
-    avro_writer_free(jsonfile_writer);
-
-    printf("\n");
-    fflush(stdout);
-
     return 0;
 }
 
-static int write_record_to_file(
-    avro_file_writer_t db,
-    char *line,
-    avro_schema_t *schema,
-    RecordSchema *recordSchema)
+/* Build the field model of a record schema. json is the schema text
+ * parsed by jansson, or NULL, and only adds logical types. */
+static RecordSchema *recordschema_from_avro(avro_schema_t schema, json_t *json)
 {
-    avro_value_iface_t  *wface =
-        avro_generic_class_from_schema(*schema);
+    schema = resolve_link(schema);
+    if (!is_avro_record(schema)) {
+        errorPrint("%s() LN%d, schema is a %s, not a record\n",
+                __func__, __LINE__, avro_type_to_name(schema));
+        return NULL;
+    }
 
-    avro_value_t record;
-    avro_generic_value_new(wface, &record);
+    RecordSchema *recordSchema = calloc(1, sizeof(RecordSchema));
+    assert(recordSchema);
 
-    char *word;
+    tstrncpy(recordSchema->name, avro_schema_name(schema), RECORD_NAME_LEN-1);
+    recordSchema->num_fields = avro_schema_record_size(schema);
+    recordSchema->fields = calloc(recordSchema->num_fields + 1, sizeof(FieldStruct));
+    assert(recordSchema->fields);
+
+    json_t *json_fields = json_object_get(json, "fields");
+
+    for (int i = 0; i < recordSchema->num_fields; i++) {
+        FieldStruct *field = (FieldStruct *)
+            (recordSchema->fields + sizeof(FieldStruct) * i);
+        json_t *json_field = json_array_get(json_fields, i);
+
+        tstrncpy(field->name, avro_schema_record_field_name(schema, i),
+                FIELD_NAME_LEN-1);
+        if (fill_field_type(field,
+                    avro_schema_record_field_get_by_index(schema, i),
+                    json_object_get(json_field, "type"))) {
+            freeRecordSchema(recordSchema);
+            return NULL;
+        }
 
-    for(int i = 0; i < recordSchema->num_fields; i++) {
-        word = strsep(&line, ",");
+        debugPrint("%s() LN%d, field %s: %s%s%s%s%s\n",
+                __func__, __LINE__, field->name,
+                field->nullable?"nullable ":"", field->type,
+                field->array_type[0]?" of ":"", field->array_type,
+                field->logical_type[0]?" (logical)":"");
+    }
 
-        avro_value_t value;
-        FieldStruct *field = (FieldStruct *)(recordSchema->fields + sizeof(FieldStruct) * i);
-        avro_value_t branch;
-        if (avro_value_get_by_name(&record, field->name, &value, NULL) == 0) {
-            if (0 == strcmp(field->type, "string")) {
-                if ((field->nullable) && (0 == strcmp(word, "null"))) {
-                    avro_value_set_branch(&value, 0, &branch);
-                    avro_value_set_null(&branch);
-                } else {
-                    avro_value_set_branch(&value, 1, &branch);
-                    avro_value_set_string(&branch, word);
-                }
-            } else if (0 == strcmp(field->type, "bytes")) {
-                if ((field->nullable) && (0 == strcmp(word, "null"))) {
-                    avro_value_set_branch(&value, 0, &branch);
-                    avro_value_set_null(&branch);
-                } else {
-                    avro_value_set_branch(&value, 1, &branch);
-                    avro_value_set_bytes(&branch, (void *)word, strlen(word));
-                }
-            } else if (0 == strcmp(field->type, "long")) {
-                if (field->nullable) {
-                    if (0 == strcmp(word, "null")) {
-                        avro_value_set_branch(&value, 0, &branch);
-                        avro_value_set_null(&branch);
-                    } else {
-                        avro_value_set_branch(&value, 1, &branch);
-                        avro_value_set_long(&branch, atol(word));
-                    }
-                } else {
-                    avro_value_set_long(&value, atol(word));
-                }
-            } else if (0 == strcmp(field->type, "int")) {
-                if (field->nullable) {
-                    if (0 == strcmp(word, "null")) {
-                        avro_value_set_branch(&value, 0, &branch);
-                        avro_value_set_null(&branch);
-                    } else {
-                        avro_value_set_branch(&value, 1, &branch);
-                        avro_value_set_int(&branch, atoi(word));
-                    }
-                } else {
-                    avro_value_set_int(&value, atoi(word));
-                }
-            } else if (0 == strcmp(field->type, "boolean")) {
-                if (0 == strcmp(word, "null")) {
-                    avro_value_set_branch(&value, 0, &branch);
-                    avro_value_set_null(&branch);
-                } else {
-                    avro_value_set_branch(&value, 1, &branch);
-                    avro_value_set_boolean(&branch, (atoi(word))?1:0);
-                }
-            } else if (0 == strcmp(field->type, "float")) {
-                if (field->nullable) {
-                    if (0 == strcmp(word, "null")) {
-                        avro_value_set_branch(&value, 0, &branch);
-                        avro_value_set_null(&branch);
-                    } else {
-                        avro_value_set_branch(&value, 1, &branch);
-                        avro_value_set_float(&branch, atof(word));
-                    }
-                } else {
-                    avro_value_set_float(&value, atof(word));
-                }
-            } else if (0 == strcmp(field->type, "array")) {
-                if (0 == strcmp(field->array_type, "int")) {
-                    avro_value_t intv1, intv2;
-                    unsigned long ultemp;
-                    char *eptr;
-                    if (word) {
-                        ultemp = strtoul(word, &eptr, 10);
-                        avro_value_append(&value, &intv1, NULL);
-                        avro_value_set_int(&intv1, (int32_t)(ultemp - INT_MAX));
-                        avro_value_append(&value, &intv2, NULL);
-                        avro_value_set_int(&intv2, INT_MAX);
-                    }
-                } else if (0 == strcmp(field->array_type, "long")) {
-                    avro_value_t longv1, longv2;
-                    unsigned long long int ulltemp;
-                    char *eptr;
-                    if (word) {
-                        ulltemp = strtoull(word, &eptr, 10);
-                    }
-                    if ( errno || (!ulltemp && word == NULL) ) {
-                        fflush(stdout); // Don't cross the streams!
-                        perror(word);
-                    }
-                    avro_value_append(&value, &longv1, NULL);
-                    avro_value_set_long(&longv1, (int64_t)(ulltemp - LONG_MAX));
-                    avro_value_append(&value, &longv2, NULL);
-                    avro_value_set_long(&longv2, LONG_MAX);
-                }
-            }
+    return recordSchema;
+}
+
+static void ensure_buffer(char **buf, size_t *cap, size_t need)
+{
+    if (need > *cap) {
+        size_t new_cap = (*cap > 0)?*cap:4096;
+        while (new_cap < need) {
+            new_cap *= 2;
         }
+        *buf = realloc(*buf, new_cap);
+        assert(*buf);
+        *cap = new_cap;
     }
+}
 
-    if (avro_file_writer_append_value(db, &record)) {
-        errorPrint(
-                "%s() LN%d, Unable to write record to file. Message: %s\n",
-                __func__, __LINE__,
-                avro_strerror());
-    }
+/* avro long: zig-zag encoded varint, at most 10 bytes */
+static int encode_long(char *buf, int64_t l)
+{
+    uint64_t n = ((uint64_t)l << 1) ^ (uint64_t)(l >> 63);
+    int len = 0;
 
-    avro_value_decref(&record);
-    avro_value_iface_decref(wface);
-    return 0;
+    while (n & ~0x7FULL) {
+        buf[len++] = (char)((n & 0x7F) | 0x80);
+        n >>= 7;
+    }
+    buf[len++] = (char)n;
+    return len;
 }
 
-static RecordSchema *parse_json_to_recordschema(json_t *element)
+static int write_long(FILE *fp, int64_t l)
 {
-    RecordSchema *recordSchema = calloc(1, sizeof(RecordSchema));
-    assert(recordSchema);
+    char buf[10];
+    int len = encode_long(buf, l);
 
-    if (JSON_OBJECT != json_typeof(element)) {
-        errorPrint("%s() LN%d, json passed is not an object\n",
-                __func__, __LINE__);
-        return NULL;
+    return (len == fwrite(buf, 1, len, fp))?0:-1;
+}
+
+static int write_avro_bytes(FILE *fp, const void *buf, size_t len)
+{
+    if (write_long(fp, len)) {
+        return -1;
     }
+    return (len == fwrite(buf, 1, len, fp))?0:-1;
+}
 
-    size_t size;
-    const char *key;
-    json_t *value;
+/* compress one block the way avro's codecs expect it:
+ * raw deflate, snappy followed by the big-endian crc32 of the input,
+ * raw lzma2. The result is appended to *out at *out_len. */
+static int codec_compress(
+        CodecType codec,
+        int level,
+        const char *data, size_t len,
+        char **out, size_t *out_cap, size_t *out_len)
+{
+    switch (codec) {
+        case CODEC_NULL:
+            ensure_buffer(out, out_cap, *out_len + len);
+            memcpy(*out + *out_len, data, len);
+            *out_len += len;
+            return 0;
+
+        case CODEC_DEFLATE:
+            {
+                z_stream zs;
+                memset(&zs, 0, sizeof(zs));
+                if (Z_OK != deflateInit2(&zs, level, Z_DEFLATED,
+                            -15, 8, Z_DEFAULT_STRATEGY)) {
+                    return -1;
+                }
+                ensure_buffer(out, out_cap, *out_len + deflateBound(&zs, len));
+                zs.next_in = (Bytef *)data;
+                zs.avail_in = len;
+                zs.next_out = (Bytef *)*out + *out_len;
+                zs.avail_out = *out_cap - *out_len;
+                int rval = deflate(&zs, Z_FINISH);
+                *out_len += zs.total_out;
+                deflateEnd(&zs);
+                return (Z_STREAM_END == rval)?0:-1;
+            }
 
-    json_object_foreach(element, key, value) {
-        if (0 == strcmp(key, "name")) {
-            tstrncpy(recordSchema->name, json_string_value(value), RECORD_NAME_LEN-1);
-        } else if (0 == strcmp(key, "fields")) {
-            if (JSON_ARRAY == json_typeof(value)) {
-
-                size_t i;
-                size_t size = json_array_size(value);
-
-                if (g_args.debug_output) {
-                    printf("%s() LN%d, JSON Array of %lld element%s:\n",
-                            __func__, __LINE__,
-                            (long long)size, json_plural(size));
+        case CODEC_SNAPPY:
+            {
+                size_t clen = snappy_max_compressed_length(len);
+                ensure_buffer(out, out_cap, *out_len + clen + 4);
+                char *dst = *out + *out_len;
+                if (SNAPPY_OK != snappy_compress(data, len, dst, &clen)) {
+                    return -1;
                 }
+                uint32_t crc = crc32(0, (const Bytef *)data, len);
+                dst[clen] = (char)(crc >> 24);
+                dst[clen+1] = (char)(crc >> 16);
+                dst[clen+2] = (char)(crc >> 8);
+                dst[clen+3] = (char)crc;
+                *out_len += clen + 4;
+                return 0;
+            }
 
-                recordSchema->num_fields = size;
-                recordSchema->fields = calloc(1, sizeof(FieldStruct) * size);
-                assert(recordSchema->fields);
-
-                for (i = 0; i < size; i++) {
-                    FieldStruct *field = (FieldStruct *)
-                        (recordSchema->fields + sizeof(FieldStruct) * i);
-                    json_t *arr_element = json_array_get(value, i);
-                    const char *ele_key;
-                    json_t *ele_value;
-
-                    json_object_foreach(arr_element, ele_key, ele_value) {
-                        if (0 == strcmp(ele_key, "name")) {
-                            tstrncpy(field->name,
-                                    json_string_value(ele_value),
-                                    FIELD_NAME_LEN-1);
-                        } else if (0 == strcmp(ele_key, "type")) {
-                            int ele_type = json_typeof(ele_value);
-
-                            if (JSON_STRING == ele_type) {
-                                tstrncpy(field->type,
-                                        json_string_value(ele_value),
-                                        TYPE_NAME_LEN-1);
-                            } else if (JSON_ARRAY == ele_type) {
-                                size_t ele_size = json_array_size(ele_value);
-
-                                for(size_t ele_i = 0; ele_i < ele_size;
-                                        ele_i ++) {
-                                    json_t *arr_type_ele =
-                                        json_array_get(ele_value, ele_i);
-
-                                    if (JSON_STRING == json_typeof(arr_type_ele)) {
-                                        const char *arr_type_ele_str =
-                                            json_string_value(arr_type_ele);
-
-                                        if(0 == strcmp(arr_type_ele_str,
-                                                            "null")) {
-                                            field->nullable = true;
-                                        } else {
-                                            tstrncpy(field->type,
-                                                    arr_type_ele_str,
-                                                    TYPE_NAME_LEN-1);
-                                        }
-                                    } else if (JSON_OBJECT ==
-                                            json_typeof(arr_type_ele)) {
-                                        const char *arr_type_ele_key;
-                                        json_t *arr_type_ele_value;
-
-                                        json_object_foreach(arr_type_ele,
-                                                arr_type_ele_key,
-                                                arr_type_ele_value) {
-                                            if (JSON_STRING ==
-                                                    json_typeof(arr_type_ele_value)) {
-                                                const char *arr_type_ele_value_str =
-                                                    json_string_value(arr_type_ele_value);
-                                                if(0 == strcmp(arr_type_ele_value_str,
-                                                            "null")) {
-                                                    field->nullable = true;
-                                                } else if(0 == strcmp(arr_type_ele_value_str,
-                                                            "array")) {
-                                                    field->is_array = true;
-                                                    tstrncpy(field->type,
-                                                            arr_type_ele_value_str,
-                                                            TYPE_NAME_LEN-1);
-                                                } else {
-                                                    tstrncpy(field->type,
-                                                            arr_type_ele_value_str,
-                                                            TYPE_NAME_LEN-1);
-                                                }
-                                            } else if (JSON_OBJECT == json_typeof(arr_type_ele_value)) {
-                                                const char *arr_type_ele_value_key;
-                                                json_t *arr_type_ele_value_value;
-
-                                                json_object_foreach(arr_type_ele_value,
-                                                        arr_type_ele_value_key,
-                                                        arr_type_ele_value_value) {
-                                                    if (JSON_STRING == json_typeof(arr_type_ele_value_value)) {
-                                                        const char *arr_type_ele_value_value_str =
-                                                            json_string_value(arr_type_ele_value_value);
-                                                        tstrncpy(field->array_type,
-                                                                arr_type_ele_value_value_str,
-                                                                TYPE_NAME_LEN-1);
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    } else {
-                                        errorPrint("%s", "Error: not supported!\n");
-                                    }
-                                }
-                            } else if (JSON_OBJECT == ele_type) {
-                                const char *obj_key;
-                                json_t *obj_value;
-
-                                json_object_foreach(ele_value, obj_key, obj_value) {
-                                    if (0 == strcmp(obj_key, "type")) {
-                                        int obj_value_type = json_typeof(obj_value);
-                                        if (JSON_STRING == obj_value_type) {
-                                            tstrncpy(field->type,
-                                                    json_string_value(obj_value), TYPE_NAME_LEN-1);
-                                            if (0 == strcmp(field->type, "array")) {
-                                                field->is_array = true;
-                                            }
-                                        } else if (JSON_OBJECT == obj_value_type) {
-                                            const char *field_key;
-                                            json_t *field_value;
-
-                                            json_object_foreach(obj_value, field_key, field_value) {
-                                                if (JSON_STRING == json_typeof(field_value)) {
-                                                    tstrncpy(field->type,
-                                                            json_string_value(field_value),
-                                                            TYPE_NAME_LEN-1);
-                                                } else {
-                                                    field->nullable = true;
-                                                }
-                                            }
-                                        }
-                                    } else if (0 == strcmp(obj_key, "items")) {
-                                        int obj_value_items = json_typeof(obj_value);
-                                        if (JSON_STRING == obj_value_items) {
-                                            field->is_array = true;
-                                            tstrncpy(field->array_type,
-                                                    json_string_value(obj_value), TYPE_NAME_LEN-1);
-                                        } else if (JSON_OBJECT == obj_value_items) {
-                                            const char *item_key;
-                                            json_t *item_value;
-
-                                            json_object_foreach(obj_value, item_key, item_value) {
-                                                if (JSON_STRING == json_typeof(item_value)) {
-                                                    tstrncpy(field->array_type,
-                                                            json_string_value(item_value),
-                                                            TYPE_NAME_LEN-1);
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        } else {
-                            printf("uncatched: %s\n", ele_key);
-                        }
-                    }
+        case CODEC_LZMA:
+            {
+                lzma_options_lzma options;
+                lzma_filter filters[2];
+
+                if (lzma_lzma_preset(&options, level)) {
+                    return -1;
                 }
-            } else {
-                errorPrint("%s() LN%d, fields have no array\n",
-                        __func__, __LINE__);
-                return NULL;
+                filters[0].id = LZMA_FILTER_LZMA2;
+                filters[0].options = &options;
+                filters[1].id = LZMA_VLI_UNKNOWN;
+                filters[1].options = NULL;
+
+                ensure_buffer(out, out_cap,
+                        *out_len + lzma_stream_buffer_bound(len));
+                if (LZMA_OK != lzma_raw_buffer_encode(filters, NULL,
+                            (const uint8_t *)data, len,
+                            (uint8_t *)*out, out_len, *out_cap)) {
+                    return -1;
+                }
+                return 0;
             }
 
-            break;
-        }
+        default:
+            return -1;
     }
-
-    return recordSchema;
 }
 
-static int write_avro_file()
+static int codec_default_level(CodecType codec)
 {
-    avro_file_writer_t  file;
-    avro_schema_t  writer_schema;
-    avro_schema_error_t  error;
-    avro_value_iface_t  *writer_iface;
-    avro_value_t  writer_value;
-    avro_value_t  field;
-
-    FILE *fp = fopen(g_args.json_filename, "r");
-    if (NULL == fp) {
-        errorPrint("Failed to open %s\n", g_args.json_filename);
-        return -1;
+    switch (codec) {
+        case CODEC_DEFLATE:
+            return Z_DEFAULT_COMPRESSION;
+        case CODEC_LZMA:
+            return LZMA_PRESET_DEFAULT;
+        default:
+            return 0;
     }
+}
 
-    fseek(fp, 0, SEEK_END);
-    int size = ftell(fp);
+static char *schema_to_json_string(avro_schema_t schema, size_t *len)
+{
+    size_t cap = 4096;
 
-    char *jsonbuf = calloc(size + 1, 1);
-    assert(jsonbuf);
-    fseek(fp, 0, SEEK_SET);
-    fread(jsonbuf, 1, size, fp);
+    for (;;) {
+        char *buf = malloc(cap);
+        assert(buf);
 
-    if (g_args.debug_output) {
-        printf("%s() LN%d\n === json content:\n%s\n", __func__, __LINE__, jsonbuf);
+        avro_writer_t writer = avro_writer_memory(buf, cap);
+        int rval = avro_schema_to_json(schema, writer);
+        *len = avro_writer_tell(writer);
+        avro_writer_free(writer);
+
+        if (0 == rval) {
+            return buf;
+        }
+        free(buf);
+        if (ENOSPC != rval) {
+            return NULL;
+        }
+        cap *= 2;
     }
+}
 
-    avro_schema_t schema;
-    if (avro_schema_from_json_length(jsonbuf, strlen(jsonbuf), &schema)) {
+static void generate_sync_marker(char *sync)
+{
+    FILE *fp = fopen("/dev/urandom", "r");
+
+    if ((NULL == fp) || (AVRO_SYNC_SIZE != fread(sync, 1, AVRO_SYNC_SIZE, fp))) {
+        srand(time(NULL) ^ getpid());
+        for (int i = 0; i < AVRO_SYNC_SIZE; i++) {
+            sync[i] = rand() & 0xFF;
+        }
+    }
+    if (fp) {
+        fclose(fp);
+    }
+}
+
+static int write_container_header(
+        FILE *fp,
+        avro_schema_t schema,
+        CodecType codec,
+        const char *sync)
+{
+    size_t json_len;
+    char *json = schema_to_json_string(schema, &json_len);
+    if (NULL == json) {
+        return -1;
+    }
+
+    const char *codec_name = g_codec_names[codec];
+    int rval = ((AVRO_MAGIC_SIZE != fwrite(AVRO_MAGIC, 1, AVRO_MAGIC_SIZE, fp))
+            || write_long(fp, 2)
+            || write_avro_bytes(fp, "avro.codec", strlen("avro.codec"))
+            || write_avro_bytes(fp, codec_name, strlen(codec_name))
+            || write_avro_bytes(fp, "avro.schema", strlen("avro.schema"))
+            || write_avro_bytes(fp, json, json_len)
+            || write_long(fp, 0)
+            || (AVRO_SYNC_SIZE != fwrite(sync, 1, AVRO_SYNC_SIZE, fp)))?-1:0;
+
+    free(json);
+    return rval;
+}
+
+static int write_container_block(
+        FILE *fp,
+        int64_t records,
+        const char *data, size_t len,
+        const char *sync)
+{
+    if (write_long(fp, records)
+            || write_long(fp, len)
+            || (len != fwrite(data, 1, len, fp))
+            || (AVRO_SYNC_SIZE != fwrite(sync, 1, AVRO_SYNC_SIZE, fp))) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Container reader: walks the header and the framing of the data
+ * blocks without going through avro_file_reader */
+typedef struct ContainerReader_S {
+    FILE            *fp;
+    avro_schema_t   schema;
+    char            *schema_json;   // schema text from the header
+    size_t          schema_json_len;
+    CodecType       codec;
+    char            sync[AVRO_SYNC_SIZE];
+    off_t           data_start;     // offset of the first block
+    bool            stream;         // stdin, skipped data is read, not seeked
+} ContainerReader;
+
+/* returns 1 on a clean EOF before the first byte */
+static int read_long(FILE *fp, int64_t *l)
+{
+    uint64_t n = 0;
+    int shift = 0;
+    int c;
+
+    do {
+        c = fgetc(fp);
+        if (EOF == c) {
+            return (0 == shift)?1:-1;
+        }
+        if (shift >= 64) {
+            return -1;
+        }
+        n |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    *l = (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+    return 0;
+}
+
+static char *read_avro_bytes(FILE *fp, int64_t *len)
+{
+    if (read_long(fp, len) || (*len < 0) || (*len > INT32_MAX)) {
+        return NULL;
+    }
+
+    char *buf = malloc(*len + 1);
+    assert(buf);
+    if (*len != fread(buf, 1, *len, fp)) {
+        free(buf);
+        return NULL;
+    }
+    buf[*len] = '\0';
+    return buf;
+}
+
+static void close_container(ContainerReader *cr)
+{
+    free(cr->schema_json);
+    cr->schema_json = NULL;
+    if (cr->schema) {
+        avro_schema_decref(cr->schema);
+        cr->schema = NULL;
+    }
+    if (cr->fp) {
+        fclose(cr->fp);
+        cr->fp = NULL;
+    }
+}
+
+static int open_container(const char *path, ContainerReader *cr)
+{
+    char magic[AVRO_MAGIC_SIZE];
+    char *json = NULL;
+    int64_t json_len = 0;
+    int64_t count;
+
+    memset(cr, 0, sizeof(ContainerReader));
+    cr->codec = CODEC_NULL;
+
+    cr->stream = is_stdio(path);
+    cr->fp = cr->stream?stdin:fopen(path, "rb");
+    if (NULL == cr->fp) {
+        errorPrint("Unable to open avro file %s\n", path);
+        return -1;
+    }
+
+    if ((AVRO_MAGIC_SIZE != fread(magic, 1, AVRO_MAGIC_SIZE, cr->fp))
+            || memcmp(magic, AVRO_MAGIC, AVRO_MAGIC_SIZE)) {
+        errorPrint("%s is not an avro container file\n", path);
+        close_container(cr);
+        return -1;
+    }
+
+    /* file metadata is a map<bytes>, blocks of key/value pairs */
+    while ((0 == read_long(cr->fp, &count)) && (0 != count)) {
+        if (count < 0) {
+            int64_t block_size;
+            count = -count;
+            if (read_long(cr->fp, &block_size)) {
+                break;
+            }
+        }
+        for (int64_t i = 0; i < count; i++) {
+            int64_t key_len, value_len;
+            char *key = read_avro_bytes(cr->fp, &key_len);
+            char *value = key?read_avro_bytes(cr->fp, &value_len):NULL;
+
+            if (NULL == value) {
+                free(key);
+                free(json);
+                errorPrint("%s has a corrupted header\n", path);
+                close_container(cr);
+                return -1;
+            }
+
+            if (0 == strcmp(key, "avro.schema")) {
+                free(json);
+                json = value;
+                json_len = value_len;
+            } else {
+                if (0 == strcmp(key, "avro.codec")) {
+                    cr->codec = codec_from_name(value);
+                }
+                free(value);
+            }
+            free(key);
+        }
+    }
+
+    if ((0 != count)
+            || (AVRO_SYNC_SIZE != fread(cr->sync, 1, AVRO_SYNC_SIZE, cr->fp))
+            || (NULL == json)) {
+        errorPrint("%s has a corrupted header\n", path);
+        free(json);
+        close_container(cr);
+        return -1;
+    }
+
+    if (CODEC_UNKNOWN == cr->codec) {
+        errorPrint("%s uses an unsupported codec\n", path);
+        free(json);
+        close_container(cr);
+        return -1;
+    }
+
+    cr->schema_json = json;
+    cr->schema_json_len = json_len;
+    cr->data_start = ftello(cr->fp);
+    if (avro_schema_from_json_length(json, json_len, &cr->schema)) {
+        errorPrint("Unable to parse schema of %s: %s\n", path, avro_strerror());
+        close_container(cr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* reads the record count and byte size of the next block,
+ * returns 1 at the end of the file */
+static int read_block_header(ContainerReader *cr, int64_t *records, int64_t *size)
+{
+    int rval = read_long(cr->fp, records);
+    if (rval) {
+        return rval;
+    }
+    if (read_long(cr->fp, size) || (*records < 0) || (*size < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* reads the block data and checks the sync marker after it */
+static int read_block_data(ContainerReader *cr, char *buf, int64_t size)
+{
+    char sync[AVRO_SYNC_SIZE];
+
+    if ((size != fread(buf, 1, size, cr->fp))
+            || (AVRO_SYNC_SIZE != fread(sync, 1, AVRO_SYNC_SIZE, cr->fp))
+            || memcmp(sync, cr->sync, AVRO_SYNC_SIZE)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* seeks over the block data, or reads through it on a stream, and
+ * checks the sync marker after it */
+static int skip_block_data(ContainerReader *cr, int64_t size)
+{
+    char sync[AVRO_SYNC_SIZE];
+
+    if (cr->stream) {
+        char buf[4096];
+        while (size > 0) {
+            size_t n = fread(buf, 1, (size < sizeof(buf))?size:sizeof(buf), cr->fp);
+            if (0 == n) {
+                return -1;
+            }
+            size -= n;
+        }
+    } else if (fseeko(cr->fp, size, SEEK_CUR)) {
+        return -1;
+    }
+    if ((AVRO_SYNC_SIZE != fread(sync, 1, AVRO_SYNC_SIZE, cr->fp))
+            || memcmp(sync, cr->sync, AVRO_SYNC_SIZE)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Block index: where each block starts and which records it holds,
+ * found by walking the block headers and sync markers without reading
+ * the data. It is cached in <file>.idx: "AVROIDX1", the sync marker,
+ * the size of the avro file it describes, u64 blocks, then one
+ * BlockIndexEntry per block, host byte order. */
+#define INDEX_MAGIC         "AVROIDX1"
+#define INDEX_MAGIC_LEN     8
+#define INDEX_SUFFIX        ".idx"
+
+typedef struct BlockIndexEntry_S {
+    uint64_t    offset;         // of the block's record count
+    uint64_t    size;           // of the block data as stored
+    uint64_t    records;
+    uint64_t    first;          // number of the block's first record
+} BlockIndexEntry;
+
+typedef struct BlockIndex_S {
+    uint64_t        num_blocks;
+    uint64_t        records;
+    BlockIndexEntry *blocks;
+} BlockIndex;
+
+static void free_block_index(BlockIndex *index)
+{
+    if (index) {
+        free(index->blocks);
+        free(index);
+    }
+}
+
+static void add_index_entry(BlockIndex *index, size_t *cap,
+        uint64_t offset, uint64_t size, uint64_t records)
+{
+    if (index->num_blocks == *cap) {
+        *cap = *cap?(*cap * 2):1024;
+        index->blocks = realloc(index->blocks, *cap * sizeof(BlockIndexEntry));
+        assert(index->blocks);
+    }
+    index->blocks[index->num_blocks].offset = offset;
+    index->blocks[index->num_blocks].size = size;
+    index->blocks[index->num_blocks].records = records;
+    index->blocks[index->num_blocks].first = index->records;
+    index->num_blocks ++;
+    index->records += records;
+}
+
+/* whether a sync marker, so a later block, follows offset */
+static bool sync_after(ContainerReader *cr, off_t offset)
+{
+    char buf[65536];
+    size_t len = 0;
+
+    if (fseeko(cr->fp, offset, SEEK_SET)) {
+        return true;
+    }
+    for (;;) {
+        size_t n = fread(buf + len, 1, sizeof(buf) - len, cr->fp);
+
+        len += n;
+        for (size_t i = 0; i + AVRO_SYNC_SIZE <= len; i++) {
+            if (0 == memcmp(buf + i, cr->sync, AVRO_SYNC_SIZE)) {
+                return true;
+            }
+        }
+        if (0 == n) {
+            return false;
+        }
+        // keep the bytes a marker across the two reads could start in
+        if (len >= AVRO_SYNC_SIZE) {
+            memmove(buf, buf + len - (AVRO_SYNC_SIZE - 1), AVRO_SYNC_SIZE - 1);
+            len = AVRO_SYNC_SIZE - 1;
+        }
+    }
+}
+
+/* walks the blocks from the first one; leaves fp at the end. With
+ * valid_end a last block cut short by a crash, one whose header or
+ * data runs past the end of the file with no sync marker after it,
+ * ends the walk instead of failing it, and *valid_end is where it
+ * starts. Damage anywhere else fails. */
+static BlockIndex *scan_block_index(ContainerReader *cr, off_t *valid_end)
+{
+    BlockIndex *index = calloc(1, sizeof(BlockIndex));
+    size_t cap = 0;
+    struct stat st;
+
+    assert(index);
+    if (fseeko(cr->fp, cr->data_start, SEEK_SET)
+            || (valid_end && fstat(fileno(cr->fp), &st))) {
+        free_block_index(index);
+        return NULL;
+    }
+    for (;;) {
+        off_t offset = ftello(cr->fp);
+        int64_t records, size;
+        int rval = read_block_header(cr, &records, &size);
+        bool torn = (0 != rval) && feof(cr->fp);
+
+        if (valid_end) {
+            *valid_end = offset;
+            torn = torn || ((0 == rval)
+                    && (size > st.st_size - ftello(cr->fp) - AVRO_SYNC_SIZE));
+        }
+        if (1 == rval) {
+            break;
+        }
+        if ((0 == rval) && skip_block_data(cr, size)) {
+            rval = -1;
+        }
+        if (rval && valid_end && torn && (!sync_after(cr, offset))) {
+            break;
+        }
+        if (rval) {
+            errorPrint("%s() LN%d, corrupted block at offset %lld\n",
+                    __func__, __LINE__, (long long)offset);
+            free_block_index(index);
+            return NULL;
+        }
+        add_index_entry(index, &cap, offset, size, records);
+    }
+    return index;
+}
+
+static BlockIndex *load_block_index(const char *path, const char *sync,
+        uint64_t file_size)
+{
+    char magic[INDEX_MAGIC_LEN];
+    char index_sync[AVRO_SYNC_SIZE];
+    uint64_t size, num_blocks;
+    FILE *fp = fopen(path, "rb");
+
+    if (NULL == fp) {
+        return NULL;
+    }
+    if ((1 != fread(magic, INDEX_MAGIC_LEN, 1, fp))
+            || memcmp(magic, INDEX_MAGIC, INDEX_MAGIC_LEN)
+            || (1 != fread(index_sync, AVRO_SYNC_SIZE, 1, fp))
+            || memcmp(index_sync, sync, AVRO_SYNC_SIZE)
+            || (1 != fread(&size, sizeof(size), 1, fp))
+            || (size != file_size)
+            || (1 != fread(&num_blocks, sizeof(num_blocks), 1, fp))
+            || (num_blocks > file_size)) {
+        fclose(fp);
+        return NULL;
+    }
+
+    BlockIndex *index = calloc(1, sizeof(BlockIndex));
+    assert(index);
+    index->blocks = malloc((num_blocks?num_blocks:1) * sizeof(BlockIndexEntry));
+    assert(index->blocks);
+    if (num_blocks != fread(index->blocks, sizeof(BlockIndexEntry), num_blocks, fp)) {
+        fclose(fp);
+        free_block_index(index);
+        return NULL;
+    }
+    fclose(fp);
+
+    index->num_blocks = num_blocks;
+    if (num_blocks) {
+        BlockIndexEntry *last = &index->blocks[num_blocks - 1];
+        index->records = last->first + last->records;
+    }
+    return index;
+}
+
+/* written aside and renamed, so that readers never see half an index */
+static int save_block_index(const char *path, const char *sync,
+        uint64_t file_size, BlockIndex *index)
+{
+    char tmp[PATH_MAX];
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    fp = fopen(tmp, "wb");
+    if (NULL == fp) {
+        return -1;
+    }
+    bool ok = (1 == fwrite(INDEX_MAGIC, INDEX_MAGIC_LEN, 1, fp))
+        && (1 == fwrite(sync, AVRO_SYNC_SIZE, 1, fp))
+        && (1 == fwrite(&file_size, sizeof(file_size), 1, fp))
+        && (1 == fwrite(&index->num_blocks, sizeof(index->num_blocks), 1, fp))
+        && (index->num_blocks == fwrite(index->blocks, sizeof(BlockIndexEntry),
+                    index->num_blocks, fp));
+    if ((0 != fclose(fp)) || (!ok) || rename(tmp, path)) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* the index of the file from its sidecar when that is up to date,
+ * otherwise scanned and cached for the next time */
+static BlockIndex *get_block_index(const char *avro_path, ContainerReader *cr)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    BlockIndex *index;
+
+    if (fstat(fileno(cr->fp), &st)) {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s"INDEX_SUFFIX, avro_path);
+    index = load_block_index(path, cr->sync, st.st_size);
+    if (index) {
+        return index;
+    }
+
+    index = scan_block_index(cr, NULL);
+    if (index && save_block_index(path, cr->sync, st.st_size, index)) {
+        debugPrint("Unable to cache the block index in %s\n", path);
+    }
+    return index;
+}
+
+/* the block holding record, num_blocks when it is past the end */
+static uint64_t find_block(BlockIndex *index, uint64_t record)
+{
+    uint64_t low = 0;
+    uint64_t high = index->num_blocks;
+
+    if (record >= index->records) {
+        return index->num_blocks;
+    }
+    while (high - low > 1) {
+        uint64_t mid = low + (high - low) / 2;
+        if (index->blocks[mid].first <= record) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int codec_decompress(
+        CodecType codec,
+        const char *data, size_t len,
+        char **out, size_t *out_cap, size_t *out_len)
+{
+    switch (codec) {
+        case CODEC_NULL:
+            ensure_buffer(out, out_cap, len);
+            memcpy(*out, data, len);
+            *out_len = len;
+            return 0;
+
+        case CODEC_DEFLATE:
+            {
+                z_stream zs;
+                int rval;
+
+                memset(&zs, 0, sizeof(zs));
+                if (Z_OK != inflateInit2(&zs, -15)) {
+                    return -1;
+                }
+                ensure_buffer(out, out_cap, len * 4);
+                zs.next_in = (Bytef *)data;
+                zs.avail_in = len;
+                do {
+                    if (zs.total_out == *out_cap) {
+                        ensure_buffer(out, out_cap, *out_cap + 1);
+                    }
+                    zs.next_out = (Bytef *)*out + zs.total_out;
+                    zs.avail_out = *out_cap - zs.total_out;
+                    rval = inflate(&zs, Z_NO_FLUSH);
+                } while (Z_OK == rval);
+                *out_len = zs.total_out;
+                inflateEnd(&zs);
+                return (Z_STREAM_END == rval)?0:-1;
+            }
+
+        case CODEC_SNAPPY:
+            {
+                size_t ulen;
+                if ((len < 4)
+                        || (SNAPPY_OK != snappy_uncompressed_length(data, len - 4, &ulen))) {
+                    return -1;
+                }
+                ensure_buffer(out, out_cap, ulen);
+                if (SNAPPY_OK != snappy_uncompress(data, len - 4, *out, &ulen)) {
+                    return -1;
+                }
+                uint32_t crc = crc32(0, (const Bytef *)*out, ulen);
+                const unsigned char *p = (const unsigned char *)data + len - 4;
+                if (crc != (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+                            | ((uint32_t)p[2] << 8) | p[3])) {
+                    return -1;
+                }
+                *out_len = ulen;
+                return 0;
+            }
+
+        case CODEC_LZMA:
+            {
+                lzma_options_lzma options;
+                lzma_filter filters[2];
+                lzma_ret rval;
+
+                lzma_lzma_preset(&options, LZMA_PRESET_DEFAULT);
+                filters[0].id = LZMA_FILTER_LZMA2;
+                filters[0].options = &options;
+                filters[1].id = LZMA_VLI_UNKNOWN;
+                filters[1].options = NULL;
+
+                ensure_buffer(out, out_cap, len * 4);
+                do {
+                    size_t in_pos = 0;
+                    size_t out_pos = 0;
+                    rval = lzma_raw_buffer_decode(filters, NULL,
+                            (const uint8_t *)data, &in_pos, len,
+                            (uint8_t *)*out, &out_pos, *out_cap);
+                    if (LZMA_OK == rval) {
+                        *out_len = out_pos;
+                        return 0;
+                    }
+                    ensure_buffer(out, out_cap, *out_cap + 1);
+                } while (LZMA_BUF_ERROR == rval);
+                return -1;
+            }
+
+        default:
+            return -1;
+    }
+}
+
+/* Ordered work pool: jobs are processed by any worker thread but handed
+ * back by pool_next_done() in submission order. At most capacity jobs are
+ * in flight, pool_submit() blocks until the oldest one is consumed. */
+typedef void (*PoolWorkFn)(void *job, int thread_idx, void *arg);
+
+typedef struct OrderedPool_S OrderedPool;
+
+typedef struct PoolThread_S {
+    OrderedPool *pool;
+    int         idx;
+    pthread_t   thread;
+} PoolThread;
+
+struct OrderedPool_S {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    PoolThread      *threads;
+    int             num_threads;
+    uint64_t        capacity;
+    void            **jobs;
+    bool            *done;
+    uint64_t        submitted;
+    uint64_t        started;
+    uint64_t        emitted;
+    bool            closed;
+    PoolWorkFn      work;
+    void            *arg;
+};
+
+static void *pool_worker(void *p)
+{
+    PoolThread *pt = p;
+    OrderedPool *pool = pt->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while ((pool->started == pool->submitted) && (!pool->closed)) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->started == pool->submitted) {
+            break;
+        }
+
+        uint64_t seq = pool->started ++;
+        void *job = pool->jobs[seq % pool->capacity];
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->work(job, pt->idx, pool->arg);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->done[seq % pool->capacity] = true;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static OrderedPool *pool_create(int num_threads, PoolWorkFn work, void *arg)
+{
+    OrderedPool *pool = calloc(1, sizeof(OrderedPool));
+    assert(pool);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->num_threads = num_threads;
+    pool->capacity = num_threads * POOL_JOBS_PER_THREAD;
+    pool->jobs = calloc(pool->capacity, sizeof(void *));
+    pool->done = calloc(pool->capacity, sizeof(bool));
+    pool->threads = calloc(num_threads, sizeof(PoolThread));
+    assert(pool->jobs && pool->done && pool->threads);
+    pool->work = work;
+    pool->arg = arg;
+
+    for (int i = 0; i < num_threads; i++) {
+        pool->threads[i].pool = pool;
+        pool->threads[i].idx = i;
+        if (pthread_create(&pool->threads[i].thread, NULL,
+                    pool_worker, &pool->threads[i])) {
+            errorPrint("%s() LN%d, failed to create thread %d\n",
+                    __func__, __LINE__, i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return pool;
+}
+
+static void pool_submit(OrderedPool *pool, void *job)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->submitted - pool->emitted >= pool->capacity) {
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    pool->jobs[pool->submitted % pool->capacity] = job;
+    pool->done[pool->submitted % pool->capacity] = false;
+    pool->submitted ++;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* no more jobs will be submitted */
+static void pool_close(OrderedPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->closed = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* returns the next finished job in submission order,
+ * NULL once the pool is closed and drained */
+static void *pool_next_done(OrderedPool *pool)
+{
+    void *job = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        uint64_t slot = pool->emitted % pool->capacity;
+        if ((pool->emitted < pool->submitted) && pool->done[slot]) {
+            job = pool->jobs[slot];
+            pool->jobs[slot] = NULL;
+            pool->emitted ++;
+            pthread_cond_broadcast(&pool->cond);
+            break;
+        }
+        if (pool->closed && (pool->emitted == pool->submitted)) {
+            break;
+        }
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return job;
+}
+
+static void pool_destroy(OrderedPool *pool)
+{
+    pool_close(pool);
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->jobs);
+    free(pool->done);
+    free(pool);
+}
+
+/* Numeric parsers of the ingest path and of --where. Fields are
+ * already trimmed slices, so unlike libc there is no locale, whitespace
+ * or base to look at, and the result tells garbage from overflow. On error the
+ * value is still what atol()/strtoull() would have returned, which is
+ * what --on-error warn writes. */
+typedef enum ParseStatus_E {
+    PARSE_OK,
+    PARSE_INVALID,
+    PARSE_OVERFLOW,
+} ParseStatus;
+
+static const char *g_parse_status_names[] = {
+    "ok", "invalid", "out of range"
+};
+
+/* 18 digits never overflow 64 bits */
+#define PARSE_SAFE_DIGITS   18
+
+static ParseStatus parse_digits(
+        const char *p, const char *end, uint64_t limit, uint64_t *out)
+{
+    const char *digits = p;
+    uint64_t v = 0;
+    ParseStatus status = PARSE_OK;
+
+    if (end - p <= PARSE_SAFE_DIGITS) {
+        for (; (p < end) && ((unsigned)(*p - '0') < 10); p++) {
+            v = v * 10 + (*p - '0');
+        }
+        if (v > limit) {
+            v = limit;
+            status = PARSE_OVERFLOW;
+        }
+    } else {
+        for (; (p < end) && ((unsigned)(*p - '0') < 10); p++) {
+            unsigned d = *p - '0';
+            if ((PARSE_OK != status) || (v > (limit - d) / 10)) {
+                v = limit;
+                status = PARSE_OVERFLOW;
+            } else {
+                v = v * 10 + d;
+            }
+        }
+    }
+
+    *out = v;
+    if ((p == digits) || (p != end)) {
+        return PARSE_INVALID;
+    }
+    return status;
+}
+
+static ParseStatus parse_int64(const char *p, size_t len, int64_t *out)
+{
+    const char *end = p + len;
+    bool negative = false;
+    uint64_t v;
+    ParseStatus status;
+
+    if ((p < end) && (('-' == *p) || ('+' == *p))) {
+        negative = ('-' == *p);
+        p ++;
+    }
+
+    status = parse_digits(p, end,
+            negative?((uint64_t)INT64_MAX + 1):INT64_MAX, &v);
+    *out = negative?(int64_t)(0 - v):(int64_t)v;
+    return status;
+}
+
+/* a leading '-' wraps around like strtoull() but is out of range */
+static ParseStatus parse_uint64(const char *p, size_t len, uint64_t *out)
+{
+    const char *end = p + len;
+    bool negative = false;
+    ParseStatus status;
+
+    if ((p < end) && (('-' == *p) || ('+' == *p))) {
+        negative = ('-' == *p);
+        p ++;
+    }
+
+    status = parse_digits(p, end, UINT64_MAX, out);
+    if (negative) {
+        *out = 0 - *out;
+        if ((PARSE_OK == status) && (0 != *out)) {
+            status = PARSE_OVERFLOW;
+        }
+    }
+    return status;
+}
+
+/* Plain decimals with a mantissa below 2^53 and a power of ten up to
+ * 1e22 are exact in a double, so one multiply or divide rounds them
+ * correctly. Anything else returns false and goes to strtod(). */
+static bool parse_double_fast(const char *p, size_t len, double *out)
+{
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *end = p + len;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+
+    if ((p < end) && (('-' == *p) || ('+' == *p))) {
+        negative = ('-' == *p);
+        p ++;
+    }
+    for (; (p < end) && ((unsigned)(*p - '0') < 10); p++, digits++) {
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+    if ((p < end) && ('.' == *p)) {
+        for (p++; (p < end) && ((unsigned)(*p - '0') < 10); p++, digits++) {
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent --;
+        }
+    }
+    if ((0 == digits) || (digits > 19) || (mantissa > (1ULL << 53))) {
+        return false;
+    }
+    if ((p < end) && (('e' == *p) || ('E' == *p))) {
+        bool negative_exp = false;
+        int e = 0;
+
+        p ++;
+        if ((p < end) && (('-' == *p) || ('+' == *p))) {
+            negative_exp = ('-' == *p);
+            p ++;
+        }
+        if ((p == end) || (end - p > 3)) {
+            return false;
+        }
+        for (; (p < end) && ((unsigned)(*p - '0') < 10); p++) {
+            e = e * 10 + (*p - '0');
+        }
+        exponent += negative_exp?-e:e;
+    }
+    if ((p != end) || (exponent < -22) || (exponent > 22)) {
+        return false;
+    }
+
+    double d = (double)mantissa;
+    d = (exponent < 0)?(d / pow10[-exponent]):(d * pow10[exponent]);
+    *out = negative?-d:d;
+    return true;
+}
+
+/* days since 1970-01-01 of a proleptic gregorian date */
+static unsigned days_in_month(int64_t y, unsigned m)
+{
+    static const unsigned days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    bool leap = (0 == y % 4) && ((0 != y % 100) || (0 == y % 400));
+
+    return days[m - 1] + ((2 == m) && leap);
+}
+
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    y -= (m <= 2);
+    int64_t era = ((y >= 0)?y:(y - 399)) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + ((m > 2)?-3:9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+/* HH:MM:SS[.ffffff] at p, as microseconds since midnight */
+static ParseStatus parse_time_of_day(const char *p, int64_t *micros, const char **end)
+{
+    unsigned h, m, sec;
+    int n = 0;
+    int64_t fraction = 0;
+    int digits = 0;
+
+    if ((3 != sscanf(p, "%2u:%2u:%2u%n", &h, &m, &sec, &n))
+            || (h > 23) || (m > 59) || (sec > 60)) {
+        return PARSE_INVALID;
+    }
+    p += n;
+    if ('.' == *p) {
+        for (p++; isdigit(*p); p++, digits++) {
+            if (digits < 6) {
+                fraction = fraction * 10 + (*p - '0');
+            }
+        }
+        for (; digits < 6; digits++) {
+            fraction *= 10;
+        }
+    }
+
+    *micros = ((int64_t)h * 3600 + m * 60 + sec) * 1000000 + fraction;
+    *end = p;
+    return PARSE_OK;
+}
+
+/* YYYY-MM-DD[(T| )HH:MM:SS[.ffffff][Z]] as microseconds since the epoch */
+static ParseStatus parse_datetime(const char *str, bool date_only, int64_t *micros)
+{
+    int y;
+    unsigned m, d;
+    int n = 0;
+    int64_t time_of_day = 0;
+    const char *p;
+
+    if ((3 != sscanf(str, "%d-%2u-%2u%n", &y, &m, &d, &n))
+            || (m < 1) || (m > 12) || (d < 1) || (d > days_in_month(y, m))) {
+        return PARSE_INVALID;
+    }
+    p = str + n;
+    if ((!date_only) && (('T' == *p) || (' ' == *p))) {
+        if (parse_time_of_day(p + 1, &time_of_day, &p)) {
+            return PARSE_INVALID;
+        }
+        if ('Z' == *p) {
+            p ++;
+        }
+    }
+    if ('\0' != *p) {
+        return PARSE_INVALID;
+    }
+
+    *micros = days_from_civil(y, m, d) * 86400 * 1000000 + time_of_day;
+    return PARSE_OK;
+}
+
+/* date, time and timestamp text, as print_*_value() shows it, to the
+ * number avro stores */
+static ParseStatus parse_temporal(FieldStruct *field, const char *str, int64_t *l)
+{
+    bool micros = (NULL != strstr(field->logical_type, "micros"));
+    const char *end;
+
+    if (0 == strcmp(field->logical_type, "date")) {
+        if (parse_datetime(str, true, l)) {
+            return PARSE_INVALID;
+        }
+        *l /= 86400LL * 1000000;
+    } else if (0 == strncmp(field->logical_type, "time-", 5)) {
+        if (parse_time_of_day(str, l, &end) || ('\0' != *end)) {
+            return PARSE_INVALID;
+        }
+        *l = micros?*l:(*l / 1000);
+    } else {
+        if (parse_datetime(str, false, l)) {
+            return PARSE_INVALID;
+        }
+        *l = micros?*l:(*l / 1000);
+    }
+    return PARSE_OK;
+}
+
+/* [-]digits[.digits] as an integer scaled by 10^scale, with no more
+ * than precision significant digits when precision is given */
+static ParseStatus parse_decimal(
+        const char *p, size_t len, int scale, int precision, __int128 *out)
+{
+    const char *end = p + len;
+    bool negative = false;
+    bool point = false;
+    bool seen = false;
+    int digits = 0;         // significant ones
+    int fraction = 0;
+    __int128 unscaled = 0;
+    ParseStatus status = PARSE_OK;
+
+    if ((p < end) && (('-' == *p) || ('+' == *p))) {
+        negative = ('-' == *p);
+        p ++;
+    }
+    for (; p < end; p++) {
+        if (('.' == *p) && (!point)) {
+            point = true;
+        } else if (isdigit(*p) && (digits < 38)) {
+            unscaled = unscaled * 10 + (*p - '0');
+            digits += (unscaled != 0);
+            fraction += point;
+            seen = true;
+        } else {
+            status = isdigit(*p)?PARSE_OVERFLOW:PARSE_INVALID;
+            break;
+        }
+    }
+    if (!seen) {
+        status = PARSE_INVALID;
+    }
+    for (; (fraction < scale) && (digits < 38); fraction++) {
+        unscaled *= 10;
+        digits += (unscaled != 0);
+    }
+    if ((PARSE_OK == status)
+            && ((fraction != scale) || ((precision > 0) && (digits > precision)))) {
+        status = (fraction > scale)?PARSE_INVALID:PARSE_OVERFLOW;
+    }
+
+    *out = negative?-unscaled:unscaled;
+    return status;
+}
+
+/* the unscaled value of a decimal, a big-endian two's complement
+ * integer of up to 16 bytes */
+static bool decimal_from_bytes(const void *buf, size_t size, __int128 *out)
+{
+    const unsigned char *p = buf;
+    __int128 unscaled = 0;
+
+    if (size > 16) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+        unscaled = (unscaled << 8) | p[i];
+    }
+    if ((size > 0) && (size < 16) && (p[0] & 0x80)) {
+        unscaled -= (__int128)1 << (size * 8);
+    }
+    *out = unscaled;
+    return true;
+}
+
+/* Output of -r. Records are formatted into a large buffer that is
+ * written out in big chunks, or that grows in memory when a worker
+ * formats a whole block for the writer thread. */
+#define OUTPUT_BUFFER_SIZE  (4*1024*1024)
+
+typedef struct OutBuf_S {
+    OutputFormat    format;
+    int             fd;         // -1 to keep everything in memory
+    char            *buf;
+    size_t          len;
+    size_t          cap;
+    bool            failed;
+} OutBuf;
+
+static void out_init(OutBuf *out, OutputFormat format, int fd)
+{
+    memset(out, 0, sizeof(OutBuf));
+    out->format = format;
+    out->fd = fd;
+    if (fd >= 0) {
+        ensure_buffer(&out->buf, &out->cap, OUTPUT_BUFFER_SIZE);
+    }
+}
+
+static int write_all(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void out_write(OutBuf *out, const char *p, size_t len)
+{
+    uint64_t t = perf_now();
+
+    if (STDOUT_FILENO == out->fd) {
+        fflush(stdout);     // keep the order of anything printed with printf
+    }
+    if ((!out->failed) && write_all(out->fd, p, len)) {
+        errorPrint("%s() LN%d, failed to write records: %s\n",
+                __func__, __LINE__, strerror(errno));
+        out->failed = true;
+    }
+    perf_count(0, 0, 0, len);
+    perf_lap(NULL, PERF_WRITE, &t);
+}
+
+static void out_flush(OutBuf *out)
+{
+    if ((out->fd >= 0) && (out->len > 0)) {
+        out_write(out, out->buf, out->len);
+        out->len = 0;
+    }
+}
+
+static void out_free(OutBuf *out)
+{
+    out_flush(out);
+    free(out->buf);
+    out->buf = NULL;
+    out->cap = 0;
+}
+
+/* room for n more bytes at the end of the buffer */
+static inline char *out_reserve(OutBuf *out, size_t n)
+{
+    if (out->len + n > out->cap) {
+        out_flush(out);
+        ensure_buffer(&out->buf, &out->cap, out->len + n);
+    }
+    return out->buf + out->len;
+}
+
+static void out_mem(OutBuf *out, const void *p, size_t n)
+{
+    if ((out->fd >= 0) && (n >= out->cap)) {
+        out_flush(out);
+        out_write(out, p, n);
+        return;
+    }
+    memcpy(out_reserve(out, n), p, n);
+    out->len += n;
+}
+
+static inline void out_char(OutBuf *out, char c)
+{
+    *out_reserve(out, 1) = c;
+    out->len ++;
+}
+
+static void out_str(OutBuf *out, const char *str)
+{
+    out_mem(out, str, strlen(str));
+}
+
+static const char g_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* digits of v written backwards, ending at end; returns the first one */
+static char *format_u64(char *end, uint64_t v)
+{
+    while (v >= 100) {
+        const char *pair = g_digit_pairs + (v % 100) * 2;
+        v /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    if (v >= 10) {
+        *--end = g_digit_pairs[v * 2 + 1];
+        *--end = g_digit_pairs[v * 2];
+    } else {
+        *--end = '0' + v;
+    }
+    return end;
+}
+
+/* v with at least width digits at p, returns the end */
+static char *put_padded(char *p, uint64_t v, int width)
+{
+    char digits[20];
+    char *first = format_u64(digits + sizeof(digits), v);
+    int len = digits + sizeof(digits) - first;
+
+    for (; len < width; width--) {
+        *p++ = '0';
+    }
+    memcpy(p, first, len);
+    return p + len;
+}
+
+static void out_u64(OutBuf *out, uint64_t v)
+{
+    char digits[20];
+    char *first = format_u64(digits + sizeof(digits), v);
+
+    out_mem(out, first, digits + sizeof(digits) - first);
+}
+
+static void out_i64(OutBuf *out, int64_t v)
+{
+    if (v < 0) {
+        out_char(out, '-');
+        out_u64(out, -(uint64_t)v);
+    } else {
+        out_u64(out, v);
+    }
+}
+
+/* m / 10^k in plain decimal notation */
+static void out_scaled(OutBuf *out, bool negative, uint64_t m, int k)
+{
+    char digits[48];
+    char *end = digits + sizeof(digits);
+    char *first = format_u64(end, m);
+
+    while (end - first < k + 1) {
+        *--first = '0';
+    }
+    if (negative) {
+        out_char(out, '-');
+    }
+    out_mem(out, first, end - first - k);
+    if (k > 0) {
+        out_char(out, '.');
+        out_mem(out, end - k, k);
+    }
+}
+
+static void out_null(OutBuf *out)
+{
+    if (FORMAT_TSV == out->format) {
+        out_mem(out, "\\N", 2);
+    } else {
+        out_mem(out, "null", 4);
+    }
+}
+
+/* Shortest %g-style text that reads back as v, for values printf
+ * doesn't have to be asked about. */
+static void out_real_printf(OutBuf *out, double v, bool is_float)
+{
+    char buf[32];
+    int n = 0;
+
+    if (!isfinite(v)) {
+        if (FORMAT_JSONL == out->format) {
+            out_null(out);
+        } else {
+            out_str(out, isnan(v)?"nan":((v < 0)?"-inf":"inf"));
+        }
+        return;
+    }
+    for (int precision = is_float?6:15; precision <= (is_float?9:17); precision++) {
+        n = snprintf(buf, sizeof(buf), "%.*g", precision, v);
+        if ((is_float && (strtof(buf, NULL) == (float)v))
+                || ((!is_float) && (strtod(buf, NULL) == v))) {
+            break;
+        }
+    }
+    out_mem(out, buf, n);
+}
+
+/* While m < 2^53 and 10^k is exact, m / 10^k is correctly rounded, the
+ * fast path parse_double_fast() takes as well. So the first k for which
+ * round(v * 10^k) / 10^k gives back v is the fewest decimals that read
+ * back as v. */
+static void out_double(OutBuf *out, double v)
+{
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    double a = fabs(v);
+
+    for (int k = 0; k < sizeof(pow10) / sizeof(pow10[0]); k++) {
+        double scaled = a * pow10[k];
+        if (!(scaled < 9007199254740992.0)) {
+            break;
+        }
+        double m = nearbyint(scaled);
+        if (m / pow10[k] == a) {
+            out_scaled(out, signbit(v), (uint64_t)m, k);
+            return;
+        }
+    }
+    out_real_printf(out, v, false);
+}
+
+/* the same in float arithmetic, exact below 2^24 and up to 1e10 */
+static void out_float(OutBuf *out, float v)
+{
+    static const float pow10[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+    };
+    float a = fabsf(v);
+
+    for (int k = 0; k < sizeof(pow10) / sizeof(pow10[0]); k++) {
+        float scaled = a * pow10[k];
+        if (!(scaled < 16777216.0f)) {
+            break;
+        }
+        float m = nearbyintf(scaled);
+        if (m / pow10[k] == a) {
+            out_scaled(out, signbit(v), (uint64_t)m, k);
+            return;
+        }
+    }
+    out_real_printf(out, v, true);
+}
+
+/* quoted when the csv reader of -w would otherwise split, trim or
+ * null it */
+static bool csv_needs_quotes(const char *p, size_t len)
+{
+    if (len == 0) {
+        return false;
+    }
+    if (isspace((unsigned char)p[0]) || isspace((unsigned char)p[len - 1])
+            || ((4 == len) && (0 == memcmp(p, "null", 4)))) {
+        return true;
+    }
+    for (size_t i = 0; i < len; i++) {
+        switch (p[i]) {
+            case ',':
+            case '"':
+            case '\'':
+            case '\\':
+            case '\n':
+            case '\r':
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+static void out_csv_text(OutBuf *out, const char *p, size_t len)
+{
+    if (!csv_needs_quotes(p, len)) {
+        out_mem(out, p, len);
+        return;
+    }
+
+    const char *start = p;
+    const char *end = p + len;
+
+    out_char(out, '"');
+    for (; p < end; p++) {
+        if ('"' == *p) {
+            out_mem(out, start, p + 1 - start);
+            start = p;      // the quote is written again
+        }
+    }
+    out_mem(out, start, end - start);
+    out_char(out, '"');
+}
+
+static void out_tsv_text(OutBuf *out, const char *p, size_t len)
+{
+    const char *start = p;
+    const char *end = p + len;
+
+    for (; p < end; p++) {
+        const char *escape;
+
+        switch (*p) {
+            case '\t': escape = "\\t"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            case '\\': escape = "\\\\"; break;
+            default: continue;
+        }
+        out_mem(out, start, p - start);
+        out_mem(out, escape, 2);
+        start = p + 1;
+    }
+    out_mem(out, start, end - start);
+}
+
+/* bytes and fixed values are json strings of code points 0-255 */
+static void out_json_text(OutBuf *out, const char *p, size_t len, bool binary)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *u = (const unsigned char *)p;
+    size_t start = 0;
+
+    out_char(out, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = u[i];
+        char escape[6];
+
+        if ((c >= 0x20) && (c != '"') && (c != '\\') && ((c < 0x80) || !binary)) {
+            continue;
+        }
+        out_mem(out, p + start, i - start);
+        start = i + 1;
+        switch (c) {
+            case '"':  out_mem(out, "\\\"", 2); break;
+            case '\\': out_mem(out, "\\\\", 2); break;
+            case '\n': out_mem(out, "\\n", 2); break;
+            case '\r': out_mem(out, "\\r", 2); break;
+            case '\t': out_mem(out, "\\t", 2); break;
+            default:
+                memcpy(escape, "\\u00", 4);
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xF];
+                out_mem(out, escape, 6);
+                break;
+        }
+    }
+    out_mem(out, p + start, len - start);
+    out_char(out, '"');
+}
+
+/* a string value, quoted and escaped as the format needs */
+static void out_text(OutBuf *out, const char *p, size_t len, bool binary)
+{
+    switch (out->format) {
+        case FORMAT_CSV:
+            out_csv_text(out, p, len);
+            break;
+        case FORMAT_TSV:
+            out_tsv_text(out, p, len);
+            break;
+        case FORMAT_JSONL:
+            out_json_text(out, p, len, binary);
+            break;
+        default:
+            out_mem(out, p, len);
+            break;
+    }
+}
+
+/* find the "null" branch and the first non-null branch of a union,
+ * both are left -1 for other schemas */
+static void resolve_union_branches(
+        avro_schema_t field_schema,
+        int *null_branch,
+        int *value_branch)
+{
+    *null_branch = -1;
+    *value_branch = -1;
+
+    if (is_avro_union(field_schema)) {
+        size_t branches = avro_schema_union_size(field_schema);
+        for (size_t b = 0; b < branches; b++) {
+            avro_schema_t branch_schema =
+                avro_schema_union_branch(field_schema, b);
+            if (is_avro_null(branch_schema)) {
+                *null_branch = b;
+            } else if (*value_branch < 0) {
+                *value_branch = b;
+            }
+        }
+    }
+}
+
+typedef struct FieldValue_S {
+    bool is_null;
+    union {
+        int32_t     n32;
+        int64_t     n64;
+        float       f;
+        double      dbl;
+        int         b;
+        uint32_t    u32;    // sum of int array items
+        uint64_t    u64;    // sum of long array items
+        struct {
+            const void  *buf;
+            size_t      size;
+        } str;
+    } v;
+} FieldValue;
+
+typedef struct ReadField_S ReadField;
+
+typedef int (*FieldDecoder)(avro_value_t *value, ReadField *rf, FieldValue *fv);
+typedef void (*FieldPrinter)(OutBuf *out, ReadField *rf, FieldValue *fv);
+
+struct ReadField_S {
+    FieldStruct     *field;
+    int             index;          // field position in the avro record
+    int             null_branch;    // union branch of "null", -1 if not nullable
+    FieldDecoder    decode;         // called with the record's field value
+    FieldDecoder    decode_value;   // called with the non-null value
+    FieldPrinter    print;
+    char            *json;          // text of the last nested value
+    char            *key;           // "name": for json lines
+    size_t          key_len;
+};
+
+typedef struct ReadPlan_S {
+    int         num_fields;
+    ReadField   *fields;
+    FieldValue  *values;
+} ReadPlan;
+
+static int decode_int_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_int(value, &fv->v.n32);
+}
+
+static int decode_long_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_long(value, &fv->v.n64);
+}
+
+static int decode_float_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_float(value, &fv->v.f);
+}
+
+static int decode_double_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_double(value, &fv->v.dbl);
+}
+
+static int decode_boolean_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_boolean(value, &fv->v.b);
+}
+
+static int decode_string_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    const char *buf;
+    size_t size;
+
+    if (avro_value_get_string(value, &buf, &size)) {
+        return -1;
+    }
+    fv->v.str.buf = buf;
+    fv->v.str.size = (size > 0)?(size - 1):0;   // size counts the NUL
+    return 0;
+}
+
+static int decode_bytes_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_bytes(value, &fv->v.str.buf, &fv->v.str.size);
+}
+
+static int decode_int_array_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    size_t array_size;
+    int32_t n32;
+
+    if (avro_value_get_size(value, &array_size)) {
+        return -1;
+    }
+    debugPrint("array_size is %d\n", (int) array_size);
+
+    fv->v.u32 = 0;
+    for (size_t item = 0; item < array_size; item ++) {
+        avro_value_t item_value;
+        if (avro_value_get_by_index(value, item, &item_value, NULL)
+                || avro_value_get_int(&item_value, &n32)) {
+            return -1;
+        }
+        fv->v.u32 += n32;
+    }
+    return 0;
+}
+
+static int decode_long_array_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    size_t array_size;
+    int64_t n64;
+
+    if (avro_value_get_size(value, &array_size)) {
+        return -1;
+    }
+    debugPrint("array_size is %d\n", (int) array_size);
+
+    fv->v.u64 = 0;
+    for (size_t item = 0; item < array_size; item ++) {
+        avro_value_t item_value;
+        if (avro_value_get_by_index(value, item, &item_value, NULL)
+                || avro_value_get_long(&item_value, &n64)) {
+            return -1;
+        }
+        fv->v.u64 += n64;
+    }
+    return 0;
+}
+
+static int decode_nullable_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    avro_value_t branch;
+    int discriminant;
+
+    if (avro_value_get_discriminant(value, &discriminant)
+            || avro_value_get_current_branch(value, &branch)) {
+        return -1;
+    }
+
+    if (discriminant == rf->null_branch) {
+        fv->is_null = true;
+        return 0;
+    }
+
+    return rf->decode_value(&branch, rf, fv);
+}
+
+static int decode_enum_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_enum(value, &fv->v.n32);
+}
+
+static int decode_fixed_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return avro_value_get_fixed(value, &fv->v.str.buf, &fv->v.str.size);
+}
+
+/* records, maps, unions and other arrays are printed as json */
+static int decode_json_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    free(rf->json);
+    rf->json = NULL;
+    if (avro_value_to_json(value, 1, &rf->json)) {
+        return -1;
+    }
+    fv->v.str.buf = rf->json;
+    fv->v.str.size = strlen(rf->json);
+    return 0;
+}
+
+static int decode_unsupported_value(avro_value_t *value, ReadField *rf, FieldValue *fv)
+{
+    return 0;
+}
+
+/* Printers write one non-null value, print_record() adds nulls and
+ * separators. The table format keeps the output of earlier versions. */
+static void print_int_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if ((FORMAT_TABLE == out->format) && (!rf->field->nullable)
+            && (((int32_t)TSDB_DATA_INT_NULL == fv->v.n32)
+                || (TSDB_DATA_SMALLINT_NULL == fv->v.n32)
+                || (TSDB_DATA_TINYINT_NULL == fv->v.n32))) {
+        out_str(out, "null?");
+    } else {
+        out_i64(out, fv->v.n32);
+    }
+}
+
+static void print_long_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if ((FORMAT_TABLE == out->format) && (!rf->field->nullable)
+            && ((int64_t)TSDB_DATA_BIGINT_NULL == fv->v.n64)) {
+        out_null(out);
+    } else {
+        out_i64(out, fv->v.n64);
+    }
+}
+
+static void print_float_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if (FORMAT_TABLE == out->format) {
+        char buf[DBL_MAX_10_EXP + 32];
+        out_mem(out, buf, snprintf(buf, sizeof(buf), "%f", fv->v.f));
+    } else {
+        out_float(out, fv->v.f);
+    }
+}
+
+static void print_double_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if (FORMAT_TABLE == out->format) {
+        char buf[DBL_MAX_10_EXP + 32];
+        out_mem(out, buf, snprintf(buf, sizeof(buf), "%f", fv->v.dbl));
+    } else {
+        out_double(out, fv->v.dbl);
+    }
+}
+
+static void print_boolean_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    out_str(out, fv->v.b?"true":"false");
+}
+
+static void print_string_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    out_text(out, fv->v.str.buf, fv->v.str.size, false);
+}
+
+static void print_bytes_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    out_text(out, fv->v.str.buf, fv->v.str.size, true);
+}
+
+/* nested values are json already */
+static void print_json_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if (FORMAT_JSONL == out->format) {
+        out_mem(out, fv->v.str.buf, fv->v.str.size);
+    } else {
+        out_text(out, fv->v.str.buf, fv->v.str.size, false);
+    }
+}
+
+static void print_int_array_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if ((FORMAT_TABLE == out->format) && (!rf->field->nullable)
+            && ((TSDB_DATA_UINT_NULL == fv->v.u32)
+                || (TSDB_DATA_USMALLINT_NULL == fv->v.u32)
+                || (TSDB_DATA_UTINYINT_NULL == fv->v.u32))) {
+        out_str(out, "null?");
+    } else {
+        out_u64(out, fv->v.u32);
+    }
+}
+
+static void print_long_array_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if ((FORMAT_TABLE == out->format) && (!rf->field->nullable)
+            && (TSDB_DATA_UBIGINT_NULL == fv->v.u64)) {
+        out_str(out, "null?");
+    } else {
+        out_u64(out, fv->v.u64);
+    }
+}
+
+static void print_enum_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    const char *symbol = avro_schema_enum_get(rf->field->schema, fv->v.n32);
+
+    symbol = symbol?symbol:"?";
+    out_text(out, symbol, strlen(symbol), false);
+}
+
+/* proleptic gregorian date of days since 1970-01-01 */
+static void civil_from_days(int64_t days, int64_t *y, unsigned *m, unsigned *d)
+{
+    days += 719468;
+    int64_t era = ((days >= 0)?days:(days - 146096)) / 146097;
+    unsigned doe = (unsigned)(days - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = (mp < 10)?(mp + 3):(mp - 9);
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+/* YYYY-MM-DD at p, returns the end */
+static char *put_date(char *p, int64_t days)
+{
+    int64_t y;
+    unsigned m, d;
+
+    civil_from_days(days, &y, &m, &d);
+    if (y < 0) {
+        *p++ = '-';
+        y = -y;
+    }
+    p = put_padded(p, y, 4);
+    *p++ = '-';
+    p = put_padded(p, m, 2);
+    *p++ = '-';
+    return put_padded(p, d, 2);
+}
+
+/* HH:MM:SS.fff or HH:MM:SS.ffffff at p, returns the end */
+static char *put_time(char *p, int64_t v, bool micros)
+{
+    int64_t per_second = micros?1000000:1000;
+    int64_t seconds = v / per_second;
+
+    p = put_padded(p, seconds / 3600, 2);
+    *p++ = ':';
+    p = put_padded(p, seconds / 60 % 60, 2);
+    *p++ = ':';
+    p = put_padded(p, seconds % 60, 2);
+    *p++ = '.';
+    return put_padded(p, v % per_second, micros?6:3);
+}
+
+/* logical types, printed the way set_*_value() parse them */
+static void print_date_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    char buf[32];
+
+    out_text(out, buf, put_date(buf, fv->v.n32) - buf, false);
+}
+
+static void print_time_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    bool micros = (0 == strcmp(rf->field->logical_type, "time-micros"));
+    int64_t v = micros?fv->v.n64:fv->v.n32;
+    char buf[48];
+
+    if (v < 0) {
+        out_i64(out, v);
+    } else {
+        out_text(out, buf, put_time(buf, v, micros) - buf, false);
+    }
+}
+
+static void print_timestamp_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    bool micros = (NULL != strstr(rf->field->logical_type, "micros"));
+    int64_t per_day = (micros?1000000:1000) * (int64_t)86400;
+    int64_t days = fv->v.n64 / per_day;
+    int64_t time_of_day = fv->v.n64 % per_day;
+    char buf[64];
+    char *p = buf;
+
+    if ((FORMAT_TABLE == out->format) && (!rf->field->nullable)
+            && ((int64_t)TSDB_DATA_BIGINT_NULL == fv->v.n64)) {
+        out_null(out);
+        return;
+    }
+    if (time_of_day < 0) {
+        time_of_day += per_day;
+        days --;
+    }
+
+    p = put_date(p, days);
+    *p++ = 'T';
+    p = put_time(p, time_of_day, micros);
+    if (strncmp(rf->field->logical_type, "local-", 6)) {
+        *p++ = 'Z';
+    }
+    out_text(out, buf, p - buf, false);
+}
+
+static void print_decimal_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    __int128 unscaled;
+    char digits[48];
+    char text[52];
+    int len = 0;
+    int n = 0;
+    int scale = rf->field->scale;
+
+    if (!decimal_from_bytes(fv->v.str.buf, fv->v.str.size, &unscaled)) {
+        out_text(out, "decimal?", 8, false);
+        return;
+    }
+
+    bool negative = (unscaled < 0);
+    unsigned __int128 u = negative?-(unsigned __int128)unscaled:unscaled;
+    do {
+        digits[len++] = '0' + (int)(u % 10);
+        u /= 10;
+    } while (((u > 0) || (len <= scale)) && (len < sizeof(digits)));
+
+    if (negative) {
+        text[n++] = '-';
+    }
+    while (len > 0) {
+        text[n++] = digits[--len];
+        if ((len == scale) && (scale > 0)) {
+            text[n++] = '.';
+        }
+    }
+    out_text(out, text, n, false);
+}
+
+static void print_unsupported_value(OutBuf *out, ReadField *rf, FieldValue *fv)
+{
+    if (FORMAT_TABLE != out->format) {
+        out_null(out);
+    }
+}
+
+static bool get_logical_decoder(
+        FieldStruct *field,
+        FieldDecoder *decode,
+        FieldPrinter *print)
+{
+    const char *logical = field->logical_type;
+
+    if (0 == logical[0]) {
+        return false;
+    }
+
+    if ((0 == strcmp(field->type, "int")) && (0 == strcmp(logical, "date"))) {
+        *decode = decode_int_value;
+        *print = print_date_value;
+    } else if ((0 == strcmp(field->type, "int"))
+            && (0 == strcmp(logical, "time-millis"))) {
+        *decode = decode_int_value;
+        *print = print_time_value;
+    } else if ((0 == strcmp(field->type, "long"))
+            && (0 == strcmp(logical, "time-micros"))) {
+        *decode = decode_long_value;
+        *print = print_time_value;
+    } else if ((0 == strcmp(field->type, "long"))
+            && (NULL != strstr(logical, "timestamp-"))) {
+        *decode = decode_long_value;
+        *print = print_timestamp_value;
+    } else if ((0 == strcmp(field->type, "bytes"))
+            && (0 == strcmp(logical, "decimal"))) {
+        *decode = decode_bytes_value;
+        *print = print_decimal_value;
+    } else if ((0 == strcmp(field->type, "fixed"))
+            && (0 == strcmp(logical, "decimal"))) {
+        *decode = decode_fixed_value;
+        *print = print_decimal_value;
+    } else {
+        // uuid, duration and unknown ones are shown as their type
+        return false;
+    }
+    return true;
+}
+
+static void get_field_decoder(
+        FieldStruct *field,
+        FieldDecoder *decode,
+        FieldPrinter *print)
+{
+    *decode = decode_unsupported_value;
+    *print = print_unsupported_value;
+
+    if (get_logical_decoder(field, decode, print)) {
+        return;
+    }
+
+    if (0 == strcmp(field->type, "int")) {
+        *decode = decode_int_value;
+        *print = print_int_value;
+    } else if (0 == strcmp(field->type, "long")) {
+        *decode = decode_long_value;
+        *print = print_long_value;
+    } else if (0 == strcmp(field->type, "float")) {
+        *decode = decode_float_value;
+        *print = print_float_value;
+    } else if (0 == strcmp(field->type, "double")) {
+        *decode = decode_double_value;
+        *print = print_double_value;
+    } else if (0 == strcmp(field->type, "boolean")) {
+        *decode = decode_boolean_value;
+        *print = print_boolean_value;
+    } else if (0 == strcmp(field->type, "string")) {
+        *decode = decode_string_value;
+        *print = print_string_value;
+    } else if (0 == strcmp(field->type, "bytes")) {
+        *decode = decode_bytes_value;
+        *print = print_bytes_value;
+    } else if (0 == strcmp(field->type, "enum")) {
+        *decode = decode_enum_value;
+        *print = print_enum_value;
+    } else if (0 == strcmp(field->type, "fixed")) {
+        *decode = decode_fixed_value;
+        *print = print_bytes_value;
+    } else if ((0 == strcmp(field->type, "array"))
+            && (0 == strcmp(field->array_type, "int"))) {
+        *decode = decode_int_array_value;
+        *print = print_int_array_value;
+    } else if ((0 == strcmp(field->type, "array"))
+            && (0 == strcmp(field->array_type, "long"))) {
+        *decode = decode_long_array_value;
+        *print = print_long_array_value;
+    } else if ((0 == strcmp(field->type, "array"))
+            || (0 == strcmp(field->type, "map"))
+            || (0 == strcmp(field->type, "record"))
+            || (0 == strcmp(field->type, "union"))) {
+        *decode = decode_json_value;
+        *print = print_json_value;
+    } else {
+        errorPrint("%s is not supported!\n", field->type);
+    }
+}
+
+static void freeReadPlan(ReadPlan *plan)
+{
+    if (plan) {
+        for (int i = 0; i < plan->num_fields; i++) {
+            free(plan->fields[i].json);
+            free(plan->fields[i].key);
+        }
+        free(plan->fields);
+        free(plan->values);
+        free(plan);
+    }
+}
+
+/* resolve field positions, union branches, decoders and printers once
+ * per file, so that the record loop does no string comparison */
+static ReadPlan *compile_read_plan(
+        avro_schema_t schema,
+        RecordSchema *recordSchema)
+{
+    ReadPlan *plan = calloc(1, sizeof(ReadPlan));
+    assert(plan);
+
+    plan->fields = calloc(recordSchema->num_fields, sizeof(ReadField));
+    assert(plan->fields);
+    plan->values = calloc(recordSchema->num_fields, sizeof(FieldValue));
+    assert(plan->values);
+
+    for (int i = 0; i < recordSchema->num_fields; i++) {
+        FieldStruct *field = (FieldStruct *)(recordSchema->fields + sizeof(FieldStruct) * i);
+        ReadField *rf = &plan->fields[plan->num_fields];
+        int value_branch;
+
+        rf->field = field;
+        rf->index = avro_schema_record_field_get_index(schema, field->name);
+        if (rf->index < 0) {
+            warnPrint("%s() LN%d, field %s is not found in schema\n",
+                    __func__, __LINE__, field->name);
+            continue;
+        }
+
+        get_field_decoder(field, &rf->decode_value, &rf->print);
+
+        OutBuf key;
+        out_init(&key, FORMAT_JSONL, -1);
+        out_json_text(&key, field->name, strlen(field->name), false);
+        out_char(&key, ':');
+        rf->key = key.buf;
+        rf->key_len = key.len;
+
+        resolve_union_branches(
+                avro_schema_record_field_get_by_index(schema, rf->index),
+                &rf->null_branch, &value_branch);
+
+        if (field->nullable && (rf->null_branch >= 0)) {
+            rf->decode = decode_nullable_value;
+        } else {
+            rf->decode = rf->decode_value;
+        }
+
+        plan->num_fields ++;
+    }
+
+    return plan;
+}
+
+static int decode_record(ReadPlan *plan, avro_value_t *record)
+{
+    for (int i = 0; i < plan->num_fields; i++) {
+        ReadField *rf = &plan->fields[i];
+        FieldValue *fv = &plan->values[i];
+        avro_value_t field_value;
+
+        fv->is_null = false;
+        if (avro_value_get_by_index(record, rf->index, &field_value, NULL)
+                || rf->decode(&field_value, rf, fv)) {
+            errorPrint("%s() LN%d, Unable to decode field %s. Message: %s\n",
+                    __func__, __LINE__, rf->field->name, avro_strerror());
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void print_record(OutBuf *out, ReadPlan *plan)
+{
+    for (int i = 0; i < plan->num_fields; i++) {
+        ReadField *rf = &plan->fields[i];
+        FieldValue *fv = &plan->values[i];
+
+        if (FORMAT_JSONL == out->format) {
+            out_char(out, (i > 0)?',':'{');
+            out_mem(out, rf->key, rf->key_len);
+        } else if ((FORMAT_CSV == out->format) && (i > 0)) {
+            out_char(out, ',');
+        } else if ((FORMAT_TSV == out->format) && (i > 0)) {
+            out_char(out, '\t');
+        }
+
+        if (fv->is_null) {
+            out_null(out);
+        } else {
+            rf->print(out, rf, fv);
+        }
+
+        if (FORMAT_TABLE == out->format) {
+            out_mem(out, " |\t", 3);
+        }
+    }
+    if (FORMAT_JSONL == out->format) {
+        out_str(out, (plan->num_fields > 0)?"}":"{}");
+    }
+    out_char(out, '\n');
+}
+
+/* the column names of csv and tsv */
+static void print_header(OutBuf *out, ReadPlan *plan)
+{
+    for (int i = 0; i < plan->num_fields; i++) {
+        const char *name = plan->fields[i].field->name;
+
+        if (i > 0) {
+            out_char(out, (FORMAT_CSV == out->format)?',':'\t');
+        }
+        out_text(out, name, strlen(name), false);
+    }
+    out_char(out, '\n');
+}
+
+/* Columnar output: records are decoded into one contiguous buffer per
+ * column, --batch-size records at a time (one batch per block with -j).
+ * Nullable fields get a validity bitmap, variable length values an
+ * offset buffer and a data buffer. */
+typedef enum ColumnType_E {
+    COLUMN_NONE,        // unsupported type, only nulls
+    COLUMN_INT32,       // int, date, time-millis
+    COLUMN_INT64,       // long, time-micros, timestamps
+    COLUMN_FLOAT,
+    COLUMN_DOUBLE,
+    COLUMN_BOOLEAN,     // one byte, 0 or 1
+    COLUMN_UINT32,      // unsigned int stored as an int array
+    COLUMN_UINT64,      // unsigned bigint stored as a long array
+    COLUMN_ENUM,        // int32 index of the symbol
+    COLUMN_STRING,      // utf-8 text
+    COLUMN_BYTES,       // bytes, fixed and decimals as stored
+    COLUMN_JSON,        // records, maps, unions and other arrays as json
+} ColumnType;
+
+static const int g_column_widths[] = {
+    0, 4, 8, 4, 8, 1, 4, 8, 4, 0, 0, 0
+};
+
+typedef struct Column_S {
+    ColumnType  type;
+    int         width;          // bytes per value, 0 for variable length
+    uint8_t     *validity;      // bit set per non-null row, NULL if not nullable
+    char        *values;        // fixed width values
+    uint64_t    *offsets;       // rows + 1 offsets into data
+    char        *data;
+    size_t      data_len;
+    size_t      data_cap;
+} Column;
+
+typedef struct ColumnBatch_S {
+    int         num_columns;
+    Column      *columns;
+    uint64_t    rows;
+    uint64_t    capacity;
+} ColumnBatch;
+
+static ColumnType column_type_of(ReadField *rf)
+{
+    static const struct {
+        FieldDecoder    decode;
+        ColumnType      type;
+    } types[] = {
+        { decode_int_value,         COLUMN_INT32 },
+        { decode_long_value,        COLUMN_INT64 },
+        { decode_float_value,       COLUMN_FLOAT },
+        { decode_double_value,      COLUMN_DOUBLE },
+        { decode_boolean_value,     COLUMN_BOOLEAN },
+        { decode_int_array_value,   COLUMN_UINT32 },
+        { decode_long_array_value,  COLUMN_UINT64 },
+        { decode_enum_value,        COLUMN_ENUM },
+        { decode_string_value,      COLUMN_STRING },
+        { decode_bytes_value,       COLUMN_BYTES },
+        { decode_fixed_value,       COLUMN_BYTES },
+        { decode_json_value,        COLUMN_JSON },
+    };
+
+    for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        if (types[t].decode == rf->decode_value) {
+            return types[t].type;
+        }
+    }
+    return COLUMN_NONE;
+}
+
+static bool column_is_variable(Column *col)
+{
+    return (COLUMN_STRING == col->type) || (COLUMN_BYTES == col->type)
+        || (COLUMN_JSON == col->type);
+}
+
+static ColumnBatch *column_batch_new(ReadPlan *plan)
+{
+    ColumnBatch *batch = calloc(1, sizeof(ColumnBatch));
+    assert(batch);
+
+    batch->num_columns = plan->num_fields;
+    batch->columns = calloc(plan->num_fields, sizeof(Column));
+    assert(batch->columns);
+
+    for (int i = 0; i < plan->num_fields; i++) {
+        batch->columns[i].type = column_type_of(&plan->fields[i]);
+        batch->columns[i].width = g_column_widths[batch->columns[i].type];
+    }
+    return batch;
+}
+
+static void column_batch_free(ColumnBatch *batch)
+{
+    if (batch) {
+        for (int i = 0; i < batch->num_columns; i++) {
+            free(batch->columns[i].validity);
+            free(batch->columns[i].values);
+            free(batch->columns[i].offsets);
+            free(batch->columns[i].data);
+        }
+        free(batch->columns);
+        free(batch);
+    }
+}
+
+/* empty the batch and make room for capacity rows */
+static void column_batch_reset(ColumnBatch *batch, ReadPlan *plan, uint64_t capacity)
+{
+    bool grow = (capacity > batch->capacity);
+
+    if (grow) {
+        batch->capacity = capacity;
+    }
+    for (int i = 0; i < batch->num_columns; i++) {
+        Column *col = &batch->columns[i];
+        size_t bitmap_len = (batch->capacity + 7) / 8;
+
+        if (plan->fields[i].field->nullable) {
+            if (grow || (NULL == col->validity)) {
+                col->validity = realloc(col->validity, bitmap_len);
+                assert(col->validity);
+            }
+            memset(col->validity, 0, bitmap_len);
+        }
+        if (grow && (col->width > 0)) {
+            col->values = realloc(col->values, batch->capacity * col->width);
+            assert(col->values);
+        }
+        if (column_is_variable(col)) {
+            if (grow || (NULL == col->offsets)) {
+                col->offsets = realloc(col->offsets,
+                        (batch->capacity + 1) * sizeof(uint64_t));
+                assert(col->offsets);
+            }
+            col->offsets[0] = 0;
+            col->data_len = 0;
+        }
+    }
+    batch->rows = 0;
+}
+
+/* add the record last decoded into plan->values */
+static void column_batch_append(ColumnBatch *batch, ReadPlan *plan)
+{
+    uint64_t row = batch->rows ++;
+
+    assert(row < batch->capacity);
+    for (int i = 0; i < batch->num_columns; i++) {
+        Column *col = &batch->columns[i];
+        FieldValue *fv = &plan->values[i];
+
+        if (col->validity && (!fv->is_null)) {
+            col->validity[row >> 3] |= 1 << (row & 7);
+        }
+
+        if (col->width > 0) {
+            char *slot = col->values + row * col->width;
+
+            if (fv->is_null) {
+                memset(slot, 0, col->width);
+            } else if (COLUMN_BOOLEAN == col->type) {
+                *slot = (0 != fv->v.b);
+            } else {
+                memcpy(slot, &fv->v, col->width);   // n32, f, u32 or n64, dbl, u64
+            }
+        } else if (col->offsets) {
+            if (!fv->is_null) {
+                ensure_buffer(&col->data, &col->data_cap,
+                        col->data_len + fv->v.str.size);
+                memcpy(col->data + col->data_len, fv->v.str.buf, fv->v.str.size);
+                col->data_len += fv->v.str.size;
+            }
+            col->offsets[row + 1] = col->data_len;
+        }
+    }
+}
+
+/* buffers start on 8 byte boundaries of the output */
+static void out_aligned(OutBuf *out, const void *p, size_t len)
+{
+    static const char zeros[8];
+
+    out_mem(out, p, len);
+    out_mem(out, zeros, (8 - len % 8) % 8);
+}
+
+/* Layout of --format columnar, all integers in host byte order
+ * (little-endian on x86 and arm), every part padded to 8 bytes:
+ *
+ *   "AVROCOL1"
+ *   u64 length, schema json
+ *   u32 columns, then per column:
+ *       u8 ColumnType, u8 nullable, u16 name length, name
+ *   batches until the end of the file:
+ *       u64 rows, then per column:
+ *           validity bitmap, (rows + 7) / 8 bytes, if nullable
+ *           fixed width: rows values
+ *           variable length: rows + 1 u64 offsets, data
+ *
+ * Null rows have a cleared validity bit and a zero or empty value. */
+static void column_header_write(OutBuf *out, ReadPlan *plan,
+        const char *schema_json, size_t schema_json_len)
+{
+    uint64_t len = schema_json_len;
+    uint32_t columns = plan->num_fields;
+    OutBuf header;
+
+    out_mem(out, "AVROCOL1", 8);
+    out_mem(out, &len, sizeof(len));
+    out_aligned(out, schema_json, len);
+
+    out_init(&header, FORMAT_COLUMNAR, -1);
+    out_mem(&header, &columns, sizeof(columns));
+    for (int i = 0; i < plan->num_fields; i++) {
+        FieldStruct *field = plan->fields[i].field;
+        uint8_t type = column_type_of(&plan->fields[i]);
+        uint8_t nullable = field->nullable;
+        uint16_t name_len = strlen(field->name);
+
+        out_mem(&header, &type, 1);
+        out_mem(&header, &nullable, 1);
+        out_mem(&header, &name_len, sizeof(name_len));
+        out_mem(&header, field->name, name_len);
+    }
+    out_aligned(out, header.buf, header.len);
+    out_free(&header);
+}
+
+/* keep the first rows only, as if the rest had never been appended */
+static void column_batch_truncate(ColumnBatch *batch, uint64_t rows)
+{
+    if (rows >= batch->rows) {
+        return;
+    }
+    for (int i = 0; i < batch->num_columns; i++) {
+        Column *col = &batch->columns[i];
+
+        if (col->validity && (rows & 7)) {
+            col->validity[rows >> 3] &= (1 << (rows & 7)) - 1;
+        }
+        if ((0 == col->width) && col->offsets) {
+            col->data_len = col->offsets[rows];
+        }
+    }
+    batch->rows = rows;
+}
+
+static void column_batch_write(OutBuf *out, ColumnBatch *batch)
+{
+    uint64_t rows = batch->rows;
+
+    out_mem(out, &rows, sizeof(rows));
+    for (int i = 0; i < batch->num_columns; i++) {
+        Column *col = &batch->columns[i];
+
+        if (col->validity) {
+            out_aligned(out, col->validity, (rows + 7) / 8);
+        }
+        if (col->width > 0) {
+            out_aligned(out, col->values, rows * col->width);
+        } else if (col->offsets) {
+            out_aligned(out, col->offsets, (rows + 1) * sizeof(uint64_t));
+            out_aligned(out, col->data, col->data_len);
+        }
+    }
+}
+
+/* --where: a filter on the decoded values of a record, compiled once
+ * per file, so that records it drops are never formatted. Literals are
+ * converted to the field's type when compiling. A comparison with a
+ * null value is false. */
+typedef enum FilterOp_E {
+    FILTER_AND,
+    FILTER_OR,
+    FILTER_NOT,
+    FILTER_IS_NULL,
+    FILTER_EQ,
+    FILTER_NE,
+    FILTER_LT,
+    FILTER_LE,
+    FILTER_GT,
+    FILTER_GE,
+} FilterOp;
+
+typedef enum FilterKind_E {
+    FILTER_INT,         // int, long, boolean, enum index, dates and times
+    FILTER_UINT,        // unsigned int and bigint arrays
+    FILTER_REAL,
+    FILTER_DECIMAL,     // unscaled
+    FILTER_TEXT,        // string, bytes, fixed and nested values as json
+} FilterKind;
+
+typedef union FilterValue_U {
+    int64_t     i;
+    uint64_t    u;
+    double      d;
+    __int128    dec;
+} FilterValue;
+
+typedef struct FilterNode_S {
+    FilterOp    op;
+    int         field;          // index in the read plan
+    ColumnType  column;
+    FilterKind  kind;
+    FilterValue v;              // the literal
+    char        *text;
+    size_t      text_len;
+    struct FilterNode_S *left;
+    struct FilterNode_S *right;
+} FilterNode;
+
+#define FILTER_UNORDERED    2   // a NaN was compared
+
+static void free_filter(FilterNode *node)
+{
+    if (node) {
+        free_filter(node->left);
+        free_filter(node->right);
+        free(node->text);
+        free(node);
+    }
+}
+
+/* the field value as the filter compares it; false for text, NaN and
+ * decimals too wide for 128 bits */
+static bool filter_value_of(FilterKind kind, ColumnType column,
+        FieldValue *fv, FilterValue *v)
+{
+    switch (kind) {
+        case FILTER_INT:
+            v->i = (COLUMN_INT64 == column)?fv->v.n64
+                :((COLUMN_BOOLEAN == column)?fv->v.b:fv->v.n32);
+            return true;
+        case FILTER_UINT:
+            v->u = (COLUMN_UINT64 == column)?fv->v.u64:fv->v.u32;
+            return true;
+        case FILTER_REAL:
+            v->d = (COLUMN_FLOAT == column)?fv->v.f:fv->v.dbl;
+            return !isnan(v->d);
+        case FILTER_DECIMAL:
+            return decimal_from_bytes(fv->v.str.buf, fv->v.str.size, &v->dec);
+        default:
+            return false;
+    }
+}
+
+static int filter_value_cmp(FilterKind kind, FilterValue *a, FilterValue *b)
+{
+    switch (kind) {
+        case FILTER_INT:    return (a->i > b->i) - (a->i < b->i);
+        case FILTER_UINT:   return (a->u > b->u) - (a->u < b->u);
+        case FILTER_REAL:
+            if ((a->d < b->d) || (a->d > b->d)) {
+                return (a->d > b->d) - (a->d < b->d);
+            }
+            return (a->d == b->d)?0:FILTER_UNORDERED;
+        default:            return (a->dec > b->dec) - (a->dec < b->dec);
+    }
+}
+
+static int filter_compare(FilterNode *node, FieldValue *fv)
+{
+    FilterValue a;
+
+    if (FILTER_TEXT == node->kind) {
+        size_t n = (fv->v.str.size < node->text_len)?fv->v.str.size:node->text_len;
+        int cmp = memcmp(fv->v.str.buf, node->text, n);
+        if (0 == cmp) {
+            return (fv->v.str.size > node->text_len) - (fv->v.str.size < node->text_len);
+        }
+        return (cmp > 0) - (cmp < 0);
+    }
+    if (!filter_value_of(node->kind, node->column, fv, &a)) {
+        return FILTER_UNORDERED;
+    }
+    return filter_value_cmp(node->kind, &a, &node->v);
+}
+
+static bool filter_match_node(FilterNode *node, FieldValue *values)
+{
+    FieldValue *fv = &values[node->field];
+    int cmp;
+
+    switch (node->op) {
+        case FILTER_AND:
+            return filter_match_node(node->left, values)
+                && filter_match_node(node->right, values);
+        case FILTER_OR:
+            return filter_match_node(node->left, values)
+                || filter_match_node(node->right, values);
+        case FILTER_NOT:
+            return !filter_match_node(node->left, values);
+        case FILTER_IS_NULL:
+            return fv->is_null;
+        default:
+            break;
+    }
+
+    if (fv->is_null) {
+        return false;
+    }
+    cmp = filter_compare(node, fv);
+    if (FILTER_UNORDERED == cmp) {
+        return FILTER_NE == node->op;
+    }
+    switch (node->op) {
+        case FILTER_EQ: return 0 == cmp;
+        case FILTER_NE: return 0 != cmp;
+        case FILTER_LT: return cmp < 0;
+        case FILTER_LE: return cmp <= 0;
+        case FILTER_GT: return cmp > 0;
+        default:        return cmp >= 0;
+    }
+}
+
+/* does the record last decoded into plan->values pass the filter */
+static bool filter_match(FilterNode *filter, ReadPlan *plan)
+{
+    return (NULL == filter) || filter_match_node(filter, plan->values);
+}
+
+/* expr    := and {OR and}
+ * and     := not {AND not}
+ * not     := NOT not | "(" expr ")" | test
+ * test    := field op value | field IS [NOT] NULL
+ *          | field [NOT] BETWEEN value AND value
+ *          | field [NOT] IN "(" value {"," value} ")"
+ * op      := = | == | != | <> | < | <= | > | >=
+ * value   := 'text' | "text" | text without spaces or ()=<>!, */
+typedef struct FilterParser_S {
+    const char  *p;
+    ReadPlan    *plan;
+    bool        failed;
+} FilterParser;
+
+static FilterNode *filter_parse_or(FilterParser *parser);
+
+static void filter_error(FilterParser *parser, const char *what, const char *name)
+{
+    if (!parser->failed) {
+        errorPrint("--where: %s%s at \"%s\"\n", name, what, parser->p);
+        parser->failed = true;
+    }
+}
+
+static void filter_skip_space(FilterParser *parser)
+{
+    while (isspace((unsigned char)*parser->p)) {
+        parser->p ++;
+    }
+}
+
+static bool filter_is_word(char c)
+{
+    return isalnum((unsigned char)c) || ('_' == c);
+}
+
+/* a keyword in any case, as a whole word */
+static bool filter_keyword(FilterParser *parser, const char *keyword)
+{
+    size_t len = strlen(keyword);
+
+    filter_skip_space(parser);
+    if ((0 == strncasecmp(parser->p, keyword, len))
+            && (!filter_is_word(parser->p[len]))) {
+        parser->p += len;
+        return true;
+    }
+    return false;
+}
+
+static bool filter_symbol(FilterParser *parser, const char *symbol)
+{
+    size_t len = strlen(symbol);
+
+    filter_skip_space(parser);
+    if (0 == strncmp(parser->p, symbol, len)) {
+        parser->p += len;
+        return true;
+    }
+    return false;
+}
+
+static FilterNode *filter_node(FilterOp op, FilterNode *left, FilterNode *right)
+{
+    FilterNode *node = calloc(1, sizeof(FilterNode));
+    assert(node);
+
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+/* the text of a value, NUL terminated, NULL when there is none */
+static char *filter_value(FilterParser *parser, size_t *len, bool *quoted)
+{
+    OutBuf text;
+    const char *p;
+
+    filter_skip_space(parser);
+    p = parser->p;
+    out_init(&text, FORMAT_TABLE, -1);
+    *quoted = (('\'' == *p) || ('"' == *p));
+
+    if (*quoted) {
+        char quote = *p++;
+        for (;;) {
+            if ('\0' == *p) {
+                filter_error(parser, "quote is not closed", "");
+                free(text.buf);
+                return NULL;
+            }
+            if ((quote == *p) && (quote == p[1])) {
+                p ++;
+            } else if (quote == *p) {
+                p ++;
+                break;
+            }
+            out_char(&text, *p++);
+        }
+    } else {
+        for (; *p && (!isspace((unsigned char)*p)) && (NULL == strchr("()=<>!,", *p)); p++) {
+            out_char(&text, *p);
+        }
+        if (p == parser->p) {
+            filter_error(parser, "a value is missing", "");
+            free(text.buf);
+            return NULL;
+        }
+    }
+
+    parser->p = p;
+    *len = text.len;
+    out_char(&text, '\0');
+    return text.buf;
+}
+
+/* convert the value to what the field's decoder gives */
+static bool filter_set_value(FilterParser *parser, FilterNode *node,
+        char *text, size_t len)
+{
+    ReadField *rf = &parser->plan->fields[node->field];
+    FieldStruct *field = rf->field;
+
+    node->column = column_type_of(rf);
+    switch (node->column) {
+        case COLUMN_INT32:
+        case COLUMN_INT64:
+            node->kind = FILTER_INT;
+            return (PARSE_OK == parse_int64(text, len, &node->v.i))
+                || (field->logical_type[0]
+                        && (PARSE_OK == parse_temporal(field, text, &node->v.i)));
+        case COLUMN_ENUM:
+            node->kind = FILTER_INT;
+            node->v.i = avro_schema_enum_get_by_name(field->schema, text);
+            return (node->v.i >= 0)
+                && ((FILTER_EQ == node->op) || (FILTER_NE == node->op));
+        case COLUMN_BOOLEAN:
+            node->kind = FILTER_INT;
+            node->v.i = (0 == strcasecmp(text, "true")) || (0 == strcmp(text, "1"));
+            return node->v.i || (0 == strcasecmp(text, "false")) || (0 == strcmp(text, "0"));
+        case COLUMN_UINT32:
+        case COLUMN_UINT64:
+            node->kind = FILTER_UINT;
+            return PARSE_OK == parse_uint64(text, len, &node->v.u);
+        case COLUMN_FLOAT:
+        case COLUMN_DOUBLE: {
+            char *end = text;
+            node->kind = FILTER_REAL;
+            if (!parse_double_fast(text, len, &node->v.d)) {
+                node->v.d = strtod(text, &end);
+                if ((end == text) || ('\0' != *end)) {
+                    return false;
+                }
+            }
+            if (COLUMN_FLOAT == node->column) {
+                node->v.d = (float)node->v.d;   // so that = finds the float
+            }
+            return true;
+        }
+        case COLUMN_BYTES:
+            if (0 == strcmp(field->logical_type, "decimal")) {
+                node->kind = FILTER_DECIMAL;
+                return PARSE_OK == parse_decimal(text, len, field->scale, 0, &node->v.dec);
+            }
+            // fall through
+        case COLUMN_STRING:
+        case COLUMN_JSON:
+            node->kind = FILTER_TEXT;
+            node->text = malloc(len + 1);
+            assert(node->text);
+            memcpy(node->text, text, len + 1);
+            node->text_len = len;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static FilterNode *filter_compare_node(FilterParser *parser, int field, FilterOp op)
+{
+    const char *start;
+    size_t len;
+    bool quoted;
+    char *text;
+
+    filter_skip_space(parser);
+    start = parser->p;
+    text = filter_value(parser, &len, &quoted);
+    if (NULL == text) {
+        return NULL;
+    }
+
+    FilterNode *node = filter_node(op, NULL, NULL);
+    node->field = field;
+
+    /* = null and != null as IS NULL and IS NOT NULL */
+    if ((!quoted) && (0 == strcasecmp(text, "null"))
+            && ((FILTER_EQ == op) || (FILTER_NE == op))) {
+        node->op = FILTER_IS_NULL;
+        if (FILTER_NE == op) {
+            node = filter_node(FILTER_NOT, node, NULL);
+        }
+    } else if (!filter_set_value(parser, node, text, len)) {
+        parser->p = start;
+        filter_error(parser, " can't be compared with this value",
+                parser->plan->fields[field].field->name);
+        free_filter(node);
+        node = NULL;
+    }
+    free(text);
+    return node;
+}
+
+static int filter_comparison(FilterParser *parser)
+{
+    static const struct {
+        const char  *symbol;
+        FilterOp    op;
+    } ops[] = {
+        { "==", FILTER_EQ }, { "!=", FILTER_NE }, { "<>", FILTER_NE },
+        { "<=", FILTER_LE }, { ">=", FILTER_GE }, { "=", FILTER_EQ },
+        { "<", FILTER_LT }, { ">", FILTER_GT },
+    };
+
+    for (int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (filter_symbol(parser, ops[i].symbol)) {
+            return ops[i].op;
+        }
+    }
+    return -1;
+}
+
+static FilterNode *filter_parse_test(FilterParser *parser)
+{
+    const char *name;
+    size_t name_len;
+    int field = -1;
+    bool negate;
+    FilterNode *node = NULL;
+
+    filter_skip_space(parser);
+    name = parser->p;
+    while (filter_is_word(*parser->p)) {
+        parser->p ++;
+    }
+    name_len = parser->p - name;
+    for (int i = 0; i < parser->plan->num_fields; i++) {
+        const char *field_name = parser->plan->fields[i].field->name;
+        if ((strlen(field_name) == name_len) && (0 == strncmp(field_name, name, name_len))) {
+            field = i;
+            break;
+        }
+    }
+    if (field < 0) {
+        parser->p = name;
+        filter_error(parser, (name_len > 0)?"unknown field, or one left out by --fields"
+                :"a field name is missing", "");
+        return NULL;
+    }
+
+    if (filter_keyword(parser, "IS")) {
+        negate = filter_keyword(parser, "NOT");
+        if (!filter_keyword(parser, "NULL")) {
+            filter_error(parser, "NULL is missing", "");
+            return NULL;
+        }
+        node = filter_node(FILTER_IS_NULL, NULL, NULL);
+        node->field = field;
+    } else {
+        negate = filter_keyword(parser, "NOT");
+        if (filter_keyword(parser, "BETWEEN")) {
+            FilterNode *low = filter_compare_node(parser, field, FILTER_GE);
+            FilterNode *high = NULL;
+            if (low && filter_keyword(parser, "AND")) {
+                high = filter_compare_node(parser, field, FILTER_LE);
+            } else {
+                filter_error(parser, "AND is missing", "");
+            }
+            if (high) {
+                node = filter_node(FILTER_AND, low, high);
+            } else {
+                free_filter(low);
+            }
+        } else if (filter_keyword(parser, "IN")) {
+            if (!filter_symbol(parser, "(")) {
+                filter_error(parser, "( is missing", "");
+                return NULL;
+            }
+            do {
+                FilterNode *eq = filter_compare_node(parser, field, FILTER_EQ);
+                if (NULL == eq) {
+                    free_filter(node);
+                    return NULL;
+                }
+                node = node?filter_node(FILTER_OR, node, eq):eq;
+            } while (filter_symbol(parser, ","));
+            if (!filter_symbol(parser, ")")) {
+                filter_error(parser, ") is missing", "");
+                free_filter(node);
+                return NULL;
+            }
+        } else if (negate) {
+            filter_error(parser, "BETWEEN or IN is missing", "");
+        } else {
+            int op = filter_comparison(parser);
+            if (op < 0) {
+                filter_error(parser, "a comparison is missing", "");
+                return NULL;
+            }
+            node = filter_compare_node(parser, field, op);
+        }
+    }
+
+    if (node && negate) {
+        node = filter_node(FILTER_NOT, node, NULL);
+    }
+    return node;
+}
+
+static FilterNode *filter_parse_not(FilterParser *parser)
+{
+    FilterNode *node;
+
+    if (filter_keyword(parser, "NOT")) {
+        node = filter_parse_not(parser);
+        return node?filter_node(FILTER_NOT, node, NULL):NULL;
+    }
+    if (filter_symbol(parser, "(")) {
+        node = filter_parse_or(parser);
+        if (node && (!filter_symbol(parser, ")"))) {
+            filter_error(parser, ") is missing", "");
+            free_filter(node);
+            return NULL;
+        }
+        return node;
+    }
+    return filter_parse_test(parser);
+}
+
+static FilterNode *filter_parse_and(FilterParser *parser)
+{
+    FilterNode *node = filter_parse_not(parser);
+
+    while (node && filter_keyword(parser, "AND")) {
+        FilterNode *right = filter_parse_not(parser);
+        if (NULL == right) {
+            free_filter(node);
+            return NULL;
+        }
+        node = filter_node(FILTER_AND, node, right);
+    }
+    return node;
+}
+
+static FilterNode *filter_parse_or(FilterParser *parser)
+{
+    FilterNode *node = filter_parse_and(parser);
+
+    while (node && filter_keyword(parser, "OR")) {
+        FilterNode *right = filter_parse_and(parser);
+        if (NULL == right) {
+            free_filter(node);
+            return NULL;
+        }
+        node = filter_node(FILTER_OR, node, right);
+    }
+    return node;
+}
+
+static FilterNode *compile_filter(const char *expr, ReadPlan *plan)
+{
+    FilterParser parser = { expr, plan, false };
+    FilterNode *filter = filter_parse_or(&parser);
+
+    filter_skip_space(&parser);
+    if (filter && ('\0' != *parser.p)) {
+        filter_error(&parser, "unexpected text", "");
+    }
+    if (parser.failed) {
+        free_filter(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+/* --stats: the ingest path keeps the null count, min and max of the
+ * listed fields for every container block in a sidecar next to the
+ * avro file, <file>.stats. Reading with --where, a block whose values
+ * can't pass the filter is seeked over before it is decompressed.
+ * Sidecar layout, host byte order:
+ *   "AVROSTS1", sync marker of the avro file,
+ *   u32 columns, and per column: u8 column type, u8 filter kind,
+ *   u16 name length, name;
+ *   then per block: u64 records, and per column: u64 nulls,
+ *   u64 values, min and max as 16 bytes each.
+ * values counts the ones that min and max cover, NaNs and decimals
+ * too wide for 128 bits left out. Those only pass a != test, which
+ * never skips a block, so the bounds stay safe. */
+#define STATS_MAGIC         "AVROSTS1"
+#define STATS_MAGIC_LEN     8
+#define STATS_SUFFIX        ".stats"
+
+typedef struct StatsColumn_S {
+    char        name[FIELD_NAME_LEN];
+    int         field;          // index in the read plan, -1 if not read
+    ColumnType  column;
+    FilterKind  kind;
+} StatsColumn;
+
+typedef struct ColumnStats_S {
+    uint64_t    nulls;
+    uint64_t    values;
+    FilterValue min;
+    FilterValue max;
+} ColumnStats;
+
+typedef struct BlockStats_S {
+    int         num_columns;
+    StatsColumn *columns;
+    uint64_t    num_blocks;
+    uint64_t    *records;       // per block
+    ColumnStats *stats;         // num_columns per block
+    int         *of_field;      // column of each read plan field, -1 if none
+} BlockStats;
+
+static void stats_path(const char *avro_path, char *path, size_t size)
+{
+    snprintf(path, size, "%s"STATS_SUFFIX, avro_path);
+}
+
+/* the columns of --stats; fields without an order, strings and
+ * nested values, are refused */
+static StatsColumn *compile_stats_columns(ReadPlan *plan, const char *list,
+        int *num_columns)
+{
+    StatsColumn *columns = calloc(plan->num_fields, sizeof(StatsColumn));
+    const char *p = list;
+    int n = 0;
+
+    assert(columns);
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        int f;
+
+        for (f = 0; f < plan->num_fields; f++) {
+            const char *name = plan->fields[f].field->name;
+            if ((strlen(name) == len) && (0 == strncmp(name, p, len))) {
+                break;
+            }
+        }
+        if (f == plan->num_fields) {
+            errorPrint("--stats: unknown field %.*s\n", (int)len, p);
+            free(columns);
+            return NULL;
+        }
+
+        ReadField *rf = &plan->fields[f];
+        StatsColumn *col = &columns[n];
+        col->field = f;
+        col->column = column_type_of(rf);
+        switch (col->column) {
+            case COLUMN_INT32:
+            case COLUMN_INT64:
+            case COLUMN_BOOLEAN:
+            case COLUMN_ENUM:
+                col->kind = FILTER_INT;
+                break;
+            case COLUMN_UINT32:
+            case COLUMN_UINT64:
+                col->kind = FILTER_UINT;
+                break;
+            case COLUMN_FLOAT:
+            case COLUMN_DOUBLE:
+                col->kind = FILTER_REAL;
+                break;
+            case COLUMN_BYTES:
+                if (0 == strcmp(rf->field->logical_type, "decimal")) {
+                    col->kind = FILTER_DECIMAL;
+                    break;
+                }
+                // fall through
+            default:
+                errorPrint("--stats: %s has no min and max, only numbers,"
+                        " dates, times and decimals do\n", rf->field->name);
+                free(columns);
+                return NULL;
+        }
+        for (int i = 0; i < n; i++) {
+            if (columns[i].field == f) {
+                errorPrint("--stats: %s is listed twice\n", rf->field->name);
+                free(columns);
+                return NULL;
+            }
+        }
+        tstrncpy(col->name, rf->field->name, FIELD_NAME_LEN);
+        n ++;
+
+        p += len;
+        if (',' == *p) {
+            p ++;
+        }
+    }
+
+    *num_columns = n;
+    return columns;
+}
+
+/* fold the fields of the record into the stats of the current block */
+static int stats_add_record(ReadPlan *plan, StatsColumn *columns, int num_columns,
+        ColumnStats *stats, avro_value_t *record)
+{
+    for (int c = 0; c < num_columns; c++) {
+        ReadField *rf = &plan->fields[columns[c].field];
+        FieldValue *fv = &plan->values[columns[c].field];
+        ColumnStats *cs = &stats[c];
+        avro_value_t field_value;
+        FilterValue v;
+
+        fv->is_null = false;
+        if (avro_value_get_by_index(record, rf->index, &field_value, NULL)
+                || rf->decode(&field_value, rf, fv)) {
+            errorPrint("%s() LN%d, Unable to decode field %s. Message: %s\n",
+                    __func__, __LINE__, rf->field->name, avro_strerror());
+            return -1;
+        }
+        if (fv->is_null) {
+            cs->nulls ++;
+            continue;
+        }
+        if (!filter_value_of(columns[c].kind, columns[c].column, fv, &v)) {
+            continue;
+        }
+        if ((0 == cs->values) || (filter_value_cmp(columns[c].kind, &v, &cs->min) < 0)) {
+            cs->min = v;
+        }
+        if ((0 == cs->values) || (filter_value_cmp(columns[c].kind, &v, &cs->max) > 0)) {
+            cs->max = v;
+        }
+        cs->values ++;
+    }
+    return 0;
+}
+
+static int stats_write_header(FILE *fp, const char *sync,
+        StatsColumn *columns, int num_columns)
+{
+    uint32_t n = num_columns;
+
+    if ((1 != fwrite(STATS_MAGIC, STATS_MAGIC_LEN, 1, fp))
+            || (1 != fwrite(sync, AVRO_SYNC_SIZE, 1, fp))
+            || (1 != fwrite(&n, sizeof(n), 1, fp))) {
+        return -1;
+    }
+    for (int c = 0; c < num_columns; c++) {
+        uint8_t types[2] = { columns[c].column, columns[c].kind };
+        uint16_t len = strlen(columns[c].name);
+        if ((1 != fwrite(types, sizeof(types), 1, fp))
+                || (1 != fwrite(&len, sizeof(len), 1, fp))
+                || (len != fwrite(columns[c].name, 1, len, fp))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int stats_write_block(FILE *fp, uint64_t records,
+        ColumnStats *stats, int num_columns)
+{
+    if (1 != fwrite(&records, sizeof(records), 1, fp)) {
+        return -1;
+    }
+    for (int c = 0; c < num_columns; c++) {
+        if ((1 != fwrite(&stats[c].nulls, sizeof(uint64_t), 1, fp))
+                || (1 != fwrite(&stats[c].values, sizeof(uint64_t), 1, fp))
+                || (1 != fwrite(&stats[c].min, sizeof(FilterValue), 1, fp))
+                || (1 != fwrite(&stats[c].max, sizeof(FilterValue), 1, fp))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_block_stats(BlockStats *bs)
+{
+    if (bs) {
+        free(bs->columns);
+        free(bs->records);
+        free(bs->stats);
+        free(bs->of_field);
+        free(bs);
+    }
+}
+
+/* reads the sidecar up to the first block into bs */
+static bool stats_read_header(FILE *fp, char *sync, BlockStats *bs)
+{
+    char magic[STATS_MAGIC_LEN];
+    uint32_t n;
+
+    if ((1 != fread(magic, STATS_MAGIC_LEN, 1, fp))
+            || memcmp(magic, STATS_MAGIC, STATS_MAGIC_LEN)
+            || (1 != fread(sync, AVRO_SYNC_SIZE, 1, fp))
+            || (1 != fread(&n, sizeof(n), 1, fp))
+            || (n > UINT16_MAX)) {
+        return false;
+    }
+
+    bs->num_columns = n;
+    bs->columns = calloc(n?n:1, sizeof(StatsColumn));
+    assert(bs->columns);
+    for (uint32_t c = 0; c < n; c++) {
+        uint8_t types[2];
+        uint16_t len;
+        StatsColumn *col = &bs->columns[c];
+
+        if ((1 != fread(types, sizeof(types), 1, fp))
+                || (1 != fread(&len, sizeof(len), 1, fp))
+                || (len >= FIELD_NAME_LEN)
+                || (len != fread(col->name, 1, len, fp))) {
+            return false;
+        }
+        col->column = types[0];
+        col->kind = types[1];
+    }
+    return true;
+}
+
+static size_t stats_block_size(int num_columns)
+{
+    return sizeof(uint64_t)
+        + num_columns * (2 * sizeof(uint64_t) + 2 * sizeof(FilterValue));
+}
+
+/* the sidecar of the avro file if there is one written along with it;
+ * columns are matched to the read plan by name and type. A block cut
+ * short at the end, by a crash while writing, is left out. */
+static BlockStats *load_block_stats(const char *avro_path, const char *sync,
+        ReadPlan *plan)
+{
+    char path[PATH_MAX];
+    char stats_sync[AVRO_SYNC_SIZE];
+    FILE *fp;
+
+    stats_path(avro_path, path, sizeof(path));
+    fp = fopen(path, "rb");
+    if (NULL == fp) {
+        return NULL;
+    }
+
+    BlockStats *bs = calloc(1, sizeof(BlockStats));
+    assert(bs);
+    if (!stats_read_header(fp, stats_sync, bs)) {
+        warnPrint("%s is damaged, not used\n", path);
+        fclose(fp);
+        free_block_stats(bs);
+        return NULL;
+    }
+    if (memcmp(stats_sync, sync, AVRO_SYNC_SIZE)) {
+        warnPrint("%s belongs to another avro file, not used\n", path);
+        fclose(fp);
+        free_block_stats(bs);
+        return NULL;
+    }
+
+    int n = bs->num_columns;
+    size_t cap = 0;
+    for (;;) {
+        uint64_t records;
+        bool whole = (1 == fread(&records, sizeof(records), 1, fp));
+
+        if (whole && (bs->num_blocks == cap)) {
+            cap = cap?(cap * 2):1024;
+            bs->records = realloc(bs->records, cap * sizeof(uint64_t));
+            bs->stats = realloc(bs->stats, cap * (n?n:1) * sizeof(ColumnStats));
+            assert(bs->records && bs->stats);
+        }
+        ColumnStats *stats = whole?&bs->stats[bs->num_blocks * n]:NULL;
+        for (int c = 0; whole && (c < n); c++) {
+            whole = (1 == fread(&stats[c].nulls, sizeof(uint64_t), 1, fp))
+                && (1 == fread(&stats[c].values, sizeof(uint64_t), 1, fp))
+                && (1 == fread(&stats[c].min, sizeof(FilterValue), 1, fp))
+                && (1 == fread(&stats[c].max, sizeof(FilterValue), 1, fp));
+        }
+        if (!whole) {
+            break;
+        }
+        bs->records[bs->num_blocks] = records;
+        bs->num_blocks ++;
+    }
+    fclose(fp);
+
+    bs->of_field = malloc(plan->num_fields * sizeof(int));
+    assert(bs->of_field);
+    for (int f = 0; f < plan->num_fields; f++) {
+        ReadField *rf = &plan->fields[f];
+        bs->of_field[f] = -1;
+        for (int c = 0; c < bs->num_columns; c++) {
+            if ((0 == strcmp(bs->columns[c].name, rf->field->name))
+                    && (bs->columns[c].column == column_type_of(rf))) {
+                bs->of_field[f] = c;
+                break;
+            }
+        }
+    }
+    return bs;
+}
+
+/* --append: the sidecar is cut to the blocks kept in the avro file. With
+ * --stats it has to hold the same columns and every one of those blocks,
+ * and is returned in *fp to go on with; a new one is started when the
+ * file has no blocks yet. */
+static int stats_prepare_append(const char *avro_path, const char *sync,
+        uint64_t blocks, StatsColumn *columns, int num_columns, FILE **fp)
+{
+    char path[PATH_MAX];
+    char stats_sync[AVRO_SYNC_SIZE];
+    BlockStats bs;
+    struct stat st;
+    FILE *f;
+
+    *fp = NULL;
+    stats_path(avro_path, path, sizeof(path));
+    f = fopen(path, "r+b");
+    memset(&bs, 0, sizeof(bs));
+    if (f && ((!stats_read_header(f, stats_sync, &bs))
+                || memcmp(stats_sync, sync, AVRO_SYNC_SIZE))) {
+        fclose(f);
+        remove(path);
+        f = NULL;
+    }
+
+    if (NULL == f) {
+        free(bs.columns);
+        if (NULL == columns) {
+            return 0;
+        }
+        if (blocks > 0) {
+            errorPrint("--stats: %s has blocks without stats, write it again"
+                    " with --stats to keep them\n", avro_path);
+            return -1;
+        }
+        f = fopen(path, "wb");
+        if ((NULL == f) || stats_write_header(f, sync, columns, num_columns)) {
+            errorPrint("There was an error creating %s\n", path);
+            if (f) {
+                fclose(f);
+            }
+            return -1;
+        }
+        *fp = f;
+        return 0;
+    }
+
+    off_t header_len = ftello(f);
+    size_t block_len = stats_block_size(bs.num_columns);
+    uint64_t have = (0 == fstat(fileno(f), &st))?
+        ((st.st_size - header_len) / block_len):0;
+    bool same = (NULL == columns) || (bs.num_columns == num_columns);
+
+    for (int c = 0; same && columns && (c < num_columns); c++) {
+        same = (0 == strcmp(bs.columns[c].name, columns[c].name))
+            && (bs.columns[c].column == columns[c].column)
+            && (bs.columns[c].kind == columns[c].kind);
+    }
+    free(bs.columns);
+    if (columns && ((!same) || (have < blocks))) {
+        errorPrint("--stats: %s has stats of other fields or of fewer blocks,"
+                " write it again to change them\n", avro_path);
+        fclose(f);
+        return -1;
+    }
+
+    if (have > blocks) {
+        have = blocks;
+    }
+    if (ftruncate(fileno(f), header_len + have * block_len)
+            || fseeko(f, 0, SEEK_END)) {
+        errorPrint("Unable to cut %s to the blocks of %s\n", path, avro_path);
+        fclose(f);
+        return -1;
+    }
+    if (columns) {
+        *fp = f;
+    } else {
+        fclose(f);
+    }
+    return 0;
+}
+
+/* false only when the stats of the block prove that none of its
+ * records passes node */
+static bool stats_may_match(FilterNode *node, BlockStats *bs, uint64_t block)
+{
+    ColumnStats *cs = NULL;
+    int c;
+
+    switch (node->op) {
+        case FILTER_AND:
+            return stats_may_match(node->left, bs, block)
+                && stats_may_match(node->right, bs, block);
+        case FILTER_OR:
+            return stats_may_match(node->left, bs, block)
+                || stats_may_match(node->right, bs, block);
+        case FILTER_NOT:
+            /* only IS NOT NULL can be told, the rest is kept */
+            if (FILTER_IS_NULL != node->left->op) {
+                return true;
+            }
+            c = bs->of_field[node->left->field];
+            return (c < 0)
+                || (bs->stats[block * bs->num_columns + c].nulls < bs->records[block]);
+        default:
+            break;
+    }
+
+    c = bs->of_field[node->field];
+    if (c < 0) {
+        return true;
+    }
+    cs = &bs->stats[block * bs->num_columns + c];
+    if (FILTER_IS_NULL == node->op) {
+        return cs->nulls > 0;
+    }
+    if ((FILTER_NE == node->op) || (bs->columns[c].kind != node->kind)) {
+        return true;
+    }
+    if (0 == cs->values) {
+        return false;
+    }
+
+    int low = filter_value_cmp(node->kind, &cs->min, &node->v);
+    int high = filter_value_cmp(node->kind, &cs->max, &node->v);
+    if ((FILTER_UNORDERED == low) || (FILTER_UNORDERED == high)) {
+        return false;   // a NaN literal, only != passes it
+    }
+    switch (node->op) {
+        case FILTER_EQ: return (low <= 0) && (high >= 0);
+        case FILTER_LT: return low < 0;
+        case FILTER_LE: return low <= 0;
+        case FILTER_GT: return high > 0;
+        default:        return high >= 0;
+    }
+}
+
+typedef struct ReadBlock_S {
+    char        *data;          // block as stored in the file
+    size_t      data_len;
+    char        *decoded;       // block after decompression
+    size_t      decoded_len;
+    size_t      decoded_cap;
+    int64_t     records;        // records in the block
+    int64_t     limit;          // records to decode from the block
+    int64_t     skip;           // of them, those before --offset
+    int64_t     matched;        // records that passed --where
+    size_t      *ends;          // output length after each one, with --where and -c
+    OutBuf      out;            // formatted records
+    ColumnBatch *batch;         // or their columns
+    int         error;
+} ReadBlock;
+
+typedef struct ReadContext_S {
+    CodecType           codec;
+    ReadPlan            **plans;        // one per worker
+    avro_value_iface_t  **classes;      // one per worker
+    avro_value_t        *values;        // one per worker
+    avro_value_iface_t  **resolvers;    // one per worker, with --fields
+    avro_value_t        *sources;       // one per worker
+    avro_reader_t       *readers;       // one per worker
+    FilterNode          *filter;
+    OrderedPool         *pool;
+    OutBuf              *out;
+    uint64_t            count;
+    bool                done;           // -c records are printed
+    bool                failed;
+} ReadContext;
+
+static void free_read_block(ReadBlock *block)
+{
+    free(block->data);
+    free(block->decoded);
+    free(block->ends);
+    free(block->out.buf);
+    column_batch_free(block->batch);
+    free(block);
+}
+
+/* The value records are read into: the record itself, or with --fields
+ * a resolved writer that skips the fields left out in the binary data
+ * and stores the others into the record. */
+static int new_source_value(
+        avro_schema_t writer_schema,
+        avro_schema_t reader_schema,
+        avro_value_t *record,
+        avro_value_iface_t **resolver,
+        avro_value_t *source)
+{
+    *resolver = NULL;
+    if (writer_schema == reader_schema) {
+        *source = *record;
+        return 0;
+    }
+
+    *resolver = avro_resolved_writer_new(writer_schema, reader_schema);
+    if ((NULL == *resolver) || avro_resolved_writer_new_value(*resolver, source)) {
+        errorPrint("%s() LN%d, Unable to resolve the selected fields. Message: %s\n",
+                __func__, __LINE__, avro_strerror());
+        return -1;
+    }
+    avro_resolved_writer_set_dest(source, record);
+    return 0;
+}
+
+static void free_source_value(avro_value_iface_t *resolver, avro_value_t *source)
+{
+    if (resolver) {
+        avro_value_decref(source);
+        avro_value_iface_decref(resolver);
+    }
+}
+
+/* worker: decompress one block, decode and format its records */
+static void read_decode_block(void *job, int thread_idx, void *arg)
+{
+    ReadContext *ctx = arg;
+    ReadBlock *block = job;
+    ReadPlan *plan = ctx->plans[thread_idx];
+    avro_value_t *value = &ctx->values[thread_idx];
+    avro_value_t *source = &ctx->sources[thread_idx];
+    avro_reader_t reader = ctx->readers[thread_idx];
+    uint64_t times[PERF_NUM_PHASES] = { 0 };
+    uint64_t t = perf_now();
+
+    if (codec_decompress(ctx->codec, block->data, block->data_len,
+                &block->decoded, &block->decoded_cap, &block->decoded_len)) {
+        errorPrint("%s() LN%d, failed to decompress block with %s\n",
+                __func__, __LINE__, g_codec_names[ctx->codec]);
+        block->error = -1;
+        return;
+    }
+    perf_lap(times, PERF_DECOMPRESS, &t);
+
+    out_init(&block->out, ctx->out->format, -1);
+    if (FORMAT_COLUMNAR == ctx->out->format) {
+        block->batch = column_batch_new(plan);
+        column_batch_reset(block->batch, plan, block->limit);
+    } else if (ctx->filter && (UINT64_MAX != g_args.count)) {
+        block->ends = malloc(block->limit * sizeof(size_t));
+        assert(block->ends);
+    }
+
+    avro_reader_memory_set_source(reader, block->decoded, block->decoded_len);
+    for (int64_t r = 0; r < block->limit; r++) {
+        if (avro_value_read(reader, source)) {
+            errorPrint("%s() LN%d, Unable to read record. Message: %s\n",
+                    __func__, __LINE__, avro_strerror());
+            block->error = -1;
+            break;
+        }
+        if (r < block->skip) {
+            continue;
+        }
+        if (decode_record(plan, value)) {
+            block->error = -1;
+            break;
+        }
+        perf_lap(times, PERF_DECODE, &t);
+        if (!filter_match(ctx->filter, plan)) {
+            continue;
+        }
+        if (block->batch) {
+            column_batch_append(block->batch, plan);
+        } else {
+            print_record(&block->out, plan);
+        }
+        perf_lap(times, PERF_FORMAT, &t);
+        if (block->ends) {
+            block->ends[block->matched] = block->out.len;
+        }
+        block->matched ++;
+    }
+    perf_add_times(times);
+}
+
+/* single writer: print blocks in file order */
+static void *read_writer_thread(void *arg)
+{
+    ReadContext *ctx = arg;
+    ReadBlock *block;
+
+    while (NULL != (block = pool_next_done(ctx->pool))) {
+        /* with --where the workers can't tell where -c ends */
+        int64_t take = block->matched;
+        size_t len = block->out.len;
+
+        if ((uint64_t)take >= g_args.count - ctx->count) {
+            take = g_args.count - ctx->count;
+            /* a batch is cut by its rows, printed text by ends */
+            if ((take < block->matched) && (NULL == block->batch)) {
+                len = (take > 0)?block->ends[take - 1]:0;
+            }
+            __atomic_store_n(&ctx->done, true, __ATOMIC_RELEASE);
+        }
+
+        if ((!ctx->failed) && block->batch && (take > 0)) {
+            column_batch_truncate(block->batch, take);
+            column_batch_write(ctx->out, block->batch);
+        } else if ((!ctx->failed) && (NULL == block->batch) && len) {
+            out_mem(ctx->out, block->out.buf, len);
+        }
+        if (block->error) {
+            __atomic_store_n(&ctx->failed, true, __ATOMIC_RELEASE);
+            perf_count(0, 1, block->data_len, 0);
+        } else if (!ctx->failed) {
+            ctx->count += take;
+            perf_count(take, 0, block->data_len, 0);
+        }
+        free_read_block(block);
+    }
+
+    return NULL;
+}
+
+static int read_records_parallel(
+        ContainerReader *cr,
+        avro_schema_t schema,
+        RecordSchema *recordSchema,
+        FilterNode *filter,
+        BlockStats *stats,
+        uint64_t first_block,
+        int64_t skip,
+        OutBuf *out,
+        uint64_t *count)
+{
+    ReadContext ctx;
+    int threads = g_args.threads;
+    int rval = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    verbosePrint("reading %s on %d threads, %s, from block %"PRIu64"%s\n",
+            g_args.read_filename, threads, g_codec_names[cr->codec], first_block,
+            stats?", skipping blocks by their stats":"");
+    ctx.codec = cr->codec;
+    ctx.out = out;
+    ctx.filter = filter;
+    ctx.plans = calloc(threads, sizeof(ReadPlan *));
+    ctx.classes = calloc(threads, sizeof(avro_value_iface_t *));
+    ctx.values = calloc(threads, sizeof(avro_value_t));
+    ctx.resolvers = calloc(threads, sizeof(avro_value_iface_t *));
+    ctx.sources = calloc(threads, sizeof(avro_value_t));
+    ctx.readers = calloc(threads, sizeof(avro_reader_t));
+    assert(ctx.plans && ctx.classes && ctx.values && ctx.resolvers
+            && ctx.sources && ctx.readers);
+
+    for (int t = 0; t < threads; t++) {
+        ctx.plans[t] = compile_read_plan(schema, recordSchema);
+        ctx.classes[t] = avro_generic_class_from_schema(schema);
+        if ((NULL == ctx.classes[t])
+                || avro_generic_value_new(ctx.classes[t], &ctx.values[t])
+                || new_source_value(cr->schema, schema, &ctx.values[t],
+                    &ctx.resolvers[t], &ctx.sources[t])) {
+            errorPrint("%s() LN%d, Unable to create record value. Message: %s\n",
+                    __func__, __LINE__, avro_strerror());
+            exit(EXIT_FAILURE);
+        }
+        ctx.readers[t] = avro_reader_memory(NULL, 0);
+    }
+
+    pthread_t writer_thread;
+    ctx.pool = pool_create(threads, read_decode_block, &ctx);
+    pthread_create(&writer_thread, NULL, read_writer_thread, &ctx);
+
+    uint64_t submitted = 0;
+    uint64_t blocks = first_block;
+    uint64_t skipped = 0;
+    int64_t records, size;
+
+    while ((filter || (submitted < g_args.count))
+            && (!__atomic_load_n(&ctx.done, __ATOMIC_ACQUIRE))
+            && (!__atomic_load_n(&ctx.failed, __ATOMIC_ACQUIRE))) {
+        int ret = read_block_header(cr, &records, &size);
+        if (1 == ret) {
+            break;
+        }
+
+        /* blocks before --offset when there is no index, on a stream */
+        if ((0 == ret) && (skip > 0) && (skip >= records)) {
+            blocks ++;
+            skip -= records;
+            if (skip_block_data(cr, size)) {
+                errorPrint("%s() LN%d, corrupted block %"PRIu64"\n",
+                        __func__, __LINE__, blocks);
+                rval = -1;
+                break;
+            }
+            continue;
+        }
+
+        if ((0 == ret) && stats && (blocks < stats->num_blocks)) {
+            if (stats->records[blocks] != (uint64_t)records) {
+                warnPrint("%s"STATS_SUFFIX" doesn't match the blocks, not used\n",
+                        g_args.read_filename);
+                stats = NULL;
+            } else if (!stats_may_match(filter, stats, blocks)) {
+                blocks ++;
+                skipped ++;
+                skip = 0;
+                if (skip_block_data(cr, size)) {
+                    errorPrint("%s() LN%d, corrupted block %"PRIu64"\n",
+                            __func__, __LINE__, blocks);
+                    rval = -1;
+                    break;
+                }
+                continue;
+            }
+        }
+        blocks ++;
+
+        ReadBlock *block = calloc(1, sizeof(ReadBlock));
+        assert(block);
+        if (0 == ret) {
+            block->data = malloc(size);
+            assert(block->data);
+            ret = read_block_data(cr, block->data, size);
+        }
+        if (ret) {
+            errorPrint("%s() LN%d, corrupted block after record %"PRIu64"\n",
+                    __func__, __LINE__, submitted);
+            free_read_block(block);
+            rval = -1;
+            break;
+        }
+
+        block->data_len = size;
+        block->records = records;
+        block->skip = (skip < records)?skip:records;
+        block->limit = records;
+        skip -= block->skip;
+        if ((NULL == filter)
+                && ((uint64_t)(records - block->skip) > g_args.count - submitted)) {
+            block->limit = block->skip + g_args.count - submitted;
+        }
+        submitted += block->limit - block->skip;
+
+        pool_submit(ctx.pool, block);
+    }
+
+    pool_close(ctx.pool);
+    pthread_join(writer_thread, NULL);
+    pool_destroy(ctx.pool);
+
+    if (ctx.failed) {
+        rval = -1;
+    }
+    debugPrint("%"PRIu64" of %"PRIu64" blocks skipped by their stats\n",
+            skipped, blocks - first_block);
+
+    for (int t = 0; t < threads; t++) {
+        freeReadPlan(ctx.plans[t]);
+        free_source_value(ctx.resolvers[t], &ctx.sources[t]);
+        avro_value_decref(&ctx.values[t]);
+        avro_value_iface_decref(ctx.classes[t]);
+        avro_reader_free(ctx.readers[t]);
+    }
+    free(ctx.plans);
+    free(ctx.classes);
+    free(ctx.values);
+    free(ctx.resolvers);
+    free(ctx.sources);
+    free(ctx.readers);
+
+    *count = ctx.count;
+    return rval;
+}
+
+/* field model of a schema, with the logical types found in its text */
+static RecordSchema *recordschema_from_json_text(
+        avro_schema_t schema, const char *json, size_t len)
+{
+    json_error_t error;
+    json_t *json_root = json_loadb(json, len, 0, &error);
+
+    if (NULL == json_root) {
+        warnPrint("%s() LN%d, json error on line %d: %s, logical types are ignored\n",
+                __func__, __LINE__, error.line, error.text);
+    } else if (g_args.debug_output) {
+        print_json(json_root);
+    }
+
+    RecordSchema *recordSchema = recordschema_from_avro(schema, json_root);
+
+    if (json_root) {
+        json_decref(json_root);
+    }
+    return recordSchema;
+}
+
+/* Keep the fields named in list, in that order, and return a reader
+ * schema of them for avro's schema resolution. */
+static avro_schema_t project_fields(
+        avro_schema_t schema,
+        RecordSchema *recordSchema,
+        const char *list)
+{
+    avro_schema_t reader_schema = avro_schema_record(
+            avro_schema_name(schema), avro_schema_namespace(schema));
+    char *fields = calloc(recordSchema->num_fields + 1, sizeof(FieldStruct));
+    bool *selected = calloc(recordSchema->num_fields + 1, sizeof(bool));
+    char *names = strdup(list);
+    char *saveptr = NULL;
+    int num_fields = 0;
+    assert(reader_schema && fields && selected && names);
+
+    for (char *name = strtok_r(names, ", ", &saveptr); name;
+            name = strtok_r(NULL, ", ", &saveptr)) {
+        int index = avro_schema_record_field_get_index(schema, name);
+
+        if ((index < 0) || (index >= recordSchema->num_fields)) {
+            errorPrint("%s() LN%d, field %s is not in the schema\n",
+                    __func__, __LINE__, name);
+            goto fail;
+        }
+        if (selected[index]) {
+            errorPrint("%s() LN%d, field %s is listed twice\n",
+                    __func__, __LINE__, name);
+            goto fail;
+        }
+        if (avro_schema_record_field_append(reader_schema, name,
+                    avro_schema_record_field_get_by_index(schema, index))) {
+            errorPrint("%s() LN%d, Unable to select field %s. Message: %s\n",
+                    __func__, __LINE__, name, avro_strerror());
+            goto fail;
+        }
+        selected[index] = true;
+        memcpy(fields + sizeof(FieldStruct) * num_fields,
+                recordSchema->fields + sizeof(FieldStruct) * index,
+                sizeof(FieldStruct));
+        num_fields ++;
+    }
+    if (0 == num_fields) {
+        errorPrint("%s", "--fields names no field\n");
+        goto fail;
+    }
+
+    for (int i = 0; i < recordSchema->num_fields; i++) {
+        if (!selected[i]) {
+            FieldStruct *field = (FieldStruct *)
+                (recordSchema->fields + sizeof(FieldStruct) * i);
+            freeRecordSchema(field->record);
+        }
+    }
+    free(recordSchema->fields);
+    recordSchema->fields = fields;
+    recordSchema->num_fields = num_fields;
+
+    free(selected);
+    free(names);
+    return reader_schema;
+
+fail:
+    avro_schema_decref(reader_schema);
+    free(fields);
+    free(selected);
+    free(names);
+    return NULL;
+}
+
+static int read_avro_file()
+{
+    avro_file_reader_t reader = NULL;
+    ContainerReader container;
+    OutBuf out;
+    int fd = STDOUT_FILENO;
+
+    /* stdin goes through the container reader, which never seeks back */
+    bool parallel = ((g_args.threads > 1) || is_stdio(g_args.read_filename))
+        && (false == g_args.schema_only);
+    bool table = (FORMAT_TABLE == g_args.format) || g_args.schema_only;
+    int rval = 0;
+
+    if (open_container(g_args.read_filename, &container)) {
+        return -1;
+    }
+    if (g_args.output_filename[0]) {
+        fd = open(g_args.output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            errorPrint("Unable to open %s: %s\n",
+                    g_args.output_filename, strerror(errno));
+            close_container(&container);
+            return -1;
+        }
+    }
+    out_init(&out, g_args.format, fd);
+
+    avro_schema_t schema = container.schema;
+    if (table) {
+        out_str(&out, "=== Schema:\n");
+        out_mem(&out, container.schema_json, container.schema_json_len);
+        out_str(&out, "\n");
+    }
+
+    uint64_t t = perf_now();
+    RecordSchema *recordSchema = recordschema_from_json_text(schema,
+            container.schema_json, container.schema_json_len);
+    if (NULL == recordSchema) {
+        errorPrint("%s", "Failed to build the field model of the schema\n");
+        rval = -1;
+    }
+    perf_lap(NULL, PERF_SCHEMA, &t);
+
+    avro_schema_t reader_schema = schema;
+    if ((0 == rval) && (!g_args.schema_only) && g_args.fields[0]) {
+        reader_schema = project_fields(schema, recordSchema, g_args.fields);
+        if (NULL == reader_schema) {
+            rval = -1;
+        }
+    }
+
+    uint64_t count = 0;
+
+    if ((0 != rval) || g_args.schema_only) {
+        // nothing to read
+    } else {
+        ReadPlan *plan = compile_read_plan(reader_schema, recordSchema);
+        FilterNode *filter = NULL;
+        BlockStats *stats = NULL;
+        uint64_t first_block = 0;
+        int64_t skip = 0;
+
+        if (g_args.where[0]) {
+            filter = compile_filter(g_args.where, plan);
+            if (NULL == filter) {
+                rval = -1;
+            }
+        }
+        /* skipping blocks needs the container reader */
+        if (filter && (!container.stream)) {
+            stats = load_block_stats(g_args.read_filename, container.sync, plan);
+            parallel = parallel || (NULL != stats);
+        }
+        if ((0 == rval) && (g_args.offset > 0) && container.stream) {
+            skip = g_args.offset;
+        } else if ((0 == rval) && (g_args.offset > 0)) {
+            BlockIndex *index = get_block_index(g_args.read_filename, &container);
+            if (NULL == index) {
+                rval = -1;
+            } else {
+                first_block = find_block(index, g_args.offset);
+                if (first_block < index->num_blocks) {
+                    BlockIndexEntry *entry = &index->blocks[first_block];
+                    skip = g_args.offset - entry->first;
+                    rval = fseeko(container.fp, entry->offset, SEEK_SET);
+                } else {
+                    rval = fseeko(container.fp, 0, SEEK_END);
+                }
+                free_block_index(index);
+            }
+            parallel = true;
+        }
+        if ((0 == rval) && (!parallel)
+                && avro_file_reader(g_args.read_filename, &reader)) {
+            errorPrint("Unable to open avro file %s: %s\n",
+                    g_args.read_filename, avro_strerror());
+            rval = -1;
+        }
+
+        if (0 != rval) {
+            // the filter doesn't compile
+        } else if (table) {
+            out_str(&out, "\n=== Records:\n");
+        } else if (FORMAT_COLUMNAR == g_args.format) {
+            column_header_write(&out, plan,
+                    container.schema_json, container.schema_json_len);
+        } else if (FORMAT_JSONL != g_args.format) {
+            print_header(&out, plan);
+        }
+
+        if (0 != rval) {
+            // nothing to read
+        } else if (parallel) {
+            rval = read_records_parallel(&container, reader_schema, recordSchema,
+                    filter, stats, first_block, skip, &out, &count);
+        } else {
+            avro_value_iface_t *value_class = avro_generic_class_from_schema(reader_schema);
+            avro_value_iface_t *resolver = NULL;
+            avro_value_t value;
+            avro_value_t source;
+            avro_generic_value_new(value_class, &value);
+            if (new_source_value(schema, reader_schema, &value, &resolver, &source)) {
+                exit(EXIT_FAILURE);
+            }
+
+            ColumnBatch *batch = NULL;
+            if (FORMAT_COLUMNAR == g_args.format) {
+                batch = column_batch_new(plan);
+                column_batch_reset(batch, plan, g_args.batch_size);
+            }
+
+            verbosePrint("reading %s with avro's file reader\n", g_args.read_filename);
+            uint64_t t = perf_now();
+            int read_rval;
+            while (0 == (read_rval = avro_file_reader_read_value(reader, &source))) {
+                if (decode_record(plan, &value)) {
+                    rval = -1;
+                    break;
+                }
+                perf_lap(NULL, PERF_DECODE, &t);
+                if (!filter_match(filter, plan)) {
+                    continue;
+                }
+                if (NULL == batch) {
+                    print_record(&out, plan);
+                } else {
+                    column_batch_append(batch, plan);
+                    if (batch->rows == g_args.batch_size) {
+                        column_batch_write(&out, batch);
+                        column_batch_reset(batch, plan, g_args.batch_size);
+                    }
+                }
+                perf_lap(NULL, PERF_FORMAT, &t);
+                perf_count(1, 0, 0, 0);
+
+                count ++;
+                if (count == g_args.count) {
+                    break;
+                }
+            }
+
+            if ((0 != read_rval) && (EOF != read_rval)) {
+                errorPrint("%s() LN%d, Unable to read record. Message: %s\n",
+                        __func__, __LINE__, avro_strerror());
+                rval = -1;
+            }
+
+            if (batch && (batch->rows > 0)) {
+                column_batch_write(&out, batch);
+            }
+            column_batch_free(batch);
+            free_source_value(resolver, &source);
+            avro_value_decref(&value);
+            avro_value_iface_decref(value_class);
+        }
+        free_block_stats(stats);
+        free_filter(filter);
+        freeReadPlan(plan);
+    }
+
+    freeRecordSchema(recordSchema);
+    if (reader_schema && (reader_schema != schema)) {
+        avro_schema_decref(reader_schema);
+    }
+    if (reader) {
+        avro_file_reader_close(reader);
+    }
+    close_container(&container);
+
+    if (table) {
+        out_str(&out, "\n");
+    }
+    out_free(&out);
+    if (out.failed) {
+        rval = -1;
+    }
+    if ((STDOUT_FILENO != fd) && close(fd)) {
+        errorPrint("Unable to close %s: %s\n",
+                g_args.output_filename, strerror(errno));
+        rval = -1;
+    }
+
+    return rval;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* -i: what the header and the block headers tell about the file. The
+ * block data is seeked over, never read, so this runs in the time of
+ * one seek and one small read per block. */
+static int inspect_avro_file()
+{
+    ContainerReader container;
+    struct stat st;
+    BlockIndex *index;
+
+    if (open_container(g_args.read_filename, &container)) {
+        return -1;
+    }
+    if (container.stream) {
+        errorPrint("%s", "-i needs a file, it seeks over the block data\n");
+        close_container(&container);
+        return -1;
+    }
+    if (fstat(fileno(container.fp), &st)
+            || (NULL == (index = get_block_index(g_args.read_filename, &container)))) {
+        close_container(&container);
+        return -1;
+    }
+
+    uint64_t data = 0;
+    uint64_t min_records = UINT64_MAX, max_records = 0;
+    uint64_t buckets[64] = { 0 };
+    uint64_t *sizes = malloc((index->num_blocks?index->num_blocks:1) * sizeof(uint64_t));
+    assert(sizes);
+
+    for (uint64_t b = 0; b < index->num_blocks; b++) {
+        BlockIndexEntry *e = &index->blocks[b];
+        data += e->size;
+        min_records = (e->records < min_records)?e->records:min_records;
+        max_records = (e->records > max_records)?e->records:max_records;
+        buckets[e->size?(63 - __builtin_clzll(e->size)):0] ++;
+        sizes[b] = e->size;
+    }
+    qsort(sizes, index->num_blocks, sizeof(uint64_t), compare_u64);
+
+    printf("=== File: %s\n", g_args.read_filename);
+    printf("codec:           %s\n", g_codec_names[container.codec]);
+    printf("file bytes:      %lld\n", (long long)st.st_size);
+    printf("header bytes:    %lld\n", (long long)container.data_start);
+    printf("records:         %"PRIu64"\n", index->records);
+    printf("blocks:          %"PRIu64"\n", index->num_blocks);
+    printf("block bytes:     %"PRIu64"\n", data);
+    printf("framing bytes:   %"PRIu64"\n",
+            (uint64_t)(st.st_size - container.data_start) - data);
+
+    if (index->num_blocks > 0) {
+        uint64_t n = index->num_blocks;
+        printf("records/block:   min %"PRIu64", avg %.1f, max %"PRIu64"\n",
+                min_records, (double)index->records / n, max_records);
+        printf("bytes/block:     min %"PRIu64", p50 %"PRIu64", p90 %"PRIu64
+                ", max %"PRIu64", avg %.1f\n", sizes[0], sizes[(n - 1) / 2],
+                sizes[(n - 1) * 9 / 10], sizes[n - 1], (double)data / n);
+        if (index->records > 0) {
+            printf("bytes/record:    %.2f\n", (double)data / index->records);
+        }
+
+        printf("\n=== Block bytes:\n");
+        for (int i = 0; i < 64; i++) {
+            if (buckets[i]) {
+                printf("%12"PRIu64" - %-12"PRIu64" %10"PRIu64" blocks\n",
+                        i?((uint64_t)1 << i):0, ((uint64_t)2 << i) - 1, buckets[i]);
+            }
+        }
+    }
+
+    if (g_args.list_blocks) {
+        printf("\n=== Blocks:\n");
+        printf("%10s %16s %16s %10s %12s\n",
+                "block", "offset", "first record", "records", "bytes");
+        for (uint64_t b = 0; b < index->num_blocks; b++) {
+            BlockIndexEntry *e = &index->blocks[b];
+            printf("%10"PRIu64" %16"PRIu64" %16"PRIu64" %10"PRIu64" %12"PRIu64"\n",
+                    b, e->offset, e->first, e->records, e->size);
+        }
+    }
+    printf("\n");
+
+    free(sizes);
+    free_block_index(index);
+    close_container(&container);
+    return 0;
+}
+
+/* --concat: the inputs have to share the schema and codec. Their blocks
+ * are copied as stored into one container, nothing is decompressed or
+ * decoded; only the sync marker after each block changes to the one of
+ * the output. */
+static int concat_avro_files()
+{
+    const char *output = g_args.concat_filename;
+    ContainerReader in;
+    avro_schema_t schema = NULL;
+    CodecType codec = CODEC_NULL;
+    struct stat out_st;
+    bool out_exists = (!is_stdio(output)) && (0 == stat(output, &out_st));
+    int rval = 0;
+
+    /* all the inputs are checked before the output is touched */
+    for (int i = 0; (0 == rval) && (i < g_args.num_concat_inputs); i++) {
+        const char *path = g_args.concat_inputs[i];
+        struct stat st;
+
+        if (out_exists && (0 == stat(path, &st))
+                && (st.st_dev == out_st.st_dev) && (st.st_ino == out_st.st_ino)) {
+            errorPrint("%s is both an input and the output\n", path);
+            return -1;
+        }
+        if (open_container(path, &in)) {
+            rval = -1;
+            break;
+        }
+        if (0 == i) {
+            schema = avro_schema_incref(in.schema);
+            codec = in.codec;
+        } else if ((!avro_schema_equal(schema, in.schema)) || (codec != in.codec)) {
+            errorPrint("%s has another schema or codec than %s\n",
+                    path, g_args.concat_inputs[0]);
+            rval = -1;
+        }
+        close_container(&in);
+    }
+    if (rval) {
+        if (schema) {
+            avro_schema_decref(schema);
+        }
+        return -1;
+    }
+
+    char sync[AVRO_SYNC_SIZE];
+    FILE *fp;
+
+    generate_sync_marker(sync);
+    if (is_stdio(output)) {
+        fp = stdout;
+    } else {
+        char stats_file[PATH_MAX];
+        stats_path(output, stats_file, sizeof(stats_file));
+        remove(stats_file);
+        fp = fopen(output, "wb");
+    }
+    if ((NULL == fp) || write_container_header(fp, schema, codec, sync)) {
+        errorPrint("There was an error creating %s\n", output);
+        if (fp && (stdout != fp)) {
+            fclose(fp);
+        }
+        avro_schema_decref(schema);
+        return -1;
+    }
+    avro_schema_decref(schema);
+
+    char *buf = NULL;
+    size_t cap = 0;
+    uint64_t records = 0;
+    uint64_t blocks = 0;
+
+    for (int i = 0; (0 == rval) && (i < g_args.num_concat_inputs); i++) {
+        const char *path = g_args.concat_inputs[i];
+
+        if (open_container(path, &in)) {
+            rval = -1;
+            break;
+        }
+        for (;;) {
+            int64_t block_records, size;
+            int ret = read_block_header(&in, &block_records, &size);
+
+            if (1 == ret) {
+                break;
+            }
+            if (0 == ret) {
+                ensure_buffer(&buf, &cap, size);
+                ret = read_block_data(&in, buf, size);
+            }
+            if (ret) {
+                errorPrint("%s() LN%d, corrupted block %"PRIu64" of %s\n",
+                        __func__, __LINE__, blocks, path);
+                rval = -1;
+                break;
+            }
+            if (write_container_block(fp, block_records, buf, size, sync)) {
+                errorPrint("%s() LN%d, failed to write block to %s\n",
+                        __func__, __LINE__, output);
+                rval = -1;
+                break;
+            }
+            records += block_records;
+            blocks ++;
+        }
+        close_container(&in);
+    }
+    free(buf);
+
+    if ((stdout == fp)?fflush(fp):fclose(fp)) {
+        errorPrint("%s() LN%d, failed to close %s\n", __func__, __LINE__, output);
+        rval = -1;
+    }
+    if (0 == rval) {
+        okPrint("%"PRIu64" records in %"PRIu64" blocks of %d files copied to %s\n",
+                records, blocks, g_args.num_concat_inputs, output);
+    }
+    return rval;
+}
+
+/* threads of the block copying modes: -j, or all cpus when it isn't given */
+static int copy_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (g_args.threads > 1) {
+        return g_args.threads;
+    }
+    return (cpus > 0)?cpus:1;
+}
+
+typedef struct SplitPart_S {
+    char        path[PATH_MAX];
+    FILE        *fp;
+    char        sync[AVRO_SYNC_SIZE];
+    uint64_t    first_block;
+    uint64_t    end_block;
+    uint64_t    records;
+    uint64_t    bytes;
+    int         error;
+} SplitPart;
+
+typedef struct SplitContext_S {
+    ContainerReader *container;
+    BlockIndex      *index;
+} SplitContext;
+
+/* worker: copy the blocks of one part, with its own read position */
+static void split_copy_part(void *job, int thread_idx, void *arg)
+{
+    SplitContext *ctx = arg;
+    SplitPart *part = job;
+    ContainerReader cr = *ctx->container;
+    char *buf = NULL;
+    size_t cap = 0;
+
+    cr.fp = fopen(g_args.split_filename, "rb");
+    if ((NULL == cr.fp)
+            || fseeko(cr.fp, ctx->index->blocks[part->first_block].offset, SEEK_SET)) {
+        part->error = -1;
+    }
+    for (uint64_t b = part->first_block; (0 == part->error) && (b < part->end_block); b++) {
+        int64_t records, size;
+
+        if (read_block_header(&cr, &records, &size)) {
+            part->error = -1;
+            break;
+        }
+        ensure_buffer(&buf, &cap, size);
+        if (read_block_data(&cr, buf, size)
+                || write_container_block(part->fp, records, buf, size, part->sync)) {
+            part->error = -1;
+            break;
+        }
+        part->records += records;
+        part->bytes += size;
+    }
+    if (cr.fp) {
+        fclose(cr.fp);
+    }
+    free(buf);
+    if (fclose(part->fp)) {
+        part->error = -1;
+    }
+}
+
+static int split_report(SplitPart *part)
+{
+    if (part->error) {
+        errorPrint("%s() LN%d, failed to copy the blocks of %s\n",
+                __func__, __LINE__, part->path);
+        return -1;
+    }
+    okPrint("%s: %"PRIu64" records in %"PRIu64" blocks, %"PRIu64" bytes\n",
+            part->path, part->records, part->end_block - part->first_block, part->bytes);
+    return 0;
+}
+
+/* the block before which the part ending near target of the running total
+ * is cut; parts keep at least one block each */
+static uint64_t split_cut(BlockIndex *index, bool by_records, double target,
+        uint64_t low, uint64_t high)
+{
+    double total = 0;
+    uint64_t b = low - 1;
+
+    for (uint64_t i = 0; i < low; i++) {
+        total += by_records?index->blocks[i].records:index->blocks[i].size;
+    }
+    while (b + 1 < high) {
+        double next = total
+            + (by_records?index->blocks[b + 1].records:index->blocks[b + 1].size);
+        if (next > target) {
+            /* cut before or after the block, whichever is nearer */
+            return (target - total < next - target)?(b + 1):(b + 2);
+        }
+        total = next;
+        b ++;
+    }
+    return high;
+}
+
+/* --split: the blocks are dealt out to --parts files of about the same
+ * bytes or records, cut at block boundaries found with the block index.
+ * The parts are written at once, one per thread, by copying the blocks
+ * as stored; each is a container of the original schema and codec. */
+static int split_avro_file()
+{
+    ContainerReader container;
+    BlockIndex *index;
+    int rval = 0;
+
+    if (g_args.split_parts <= 0) {
+        errorPrint("%s", "--split needs --parts\n");
+        return -1;
+    }
+    if (open_container(g_args.split_filename, &container)) {
+        return -1;
+    }
+    if (container.stream) {
+        errorPrint("%s", "--split needs a file, it seeks to the blocks\n");
+        close_container(&container);
+        return -1;
+    }
+    index = get_block_index(g_args.split_filename, &container);
+    if (NULL == index) {
+        close_container(&container);
+        return -1;
+    }
+
+    if (0 == index->num_blocks) {
+        errorPrint("%s has no blocks to split\n", g_args.split_filename);
+        free_block_index(index);
+        close_container(&container);
+        return -1;
+    }
+
+    int num_parts = g_args.split_parts;
+    if ((uint64_t)num_parts > index->num_blocks) {
+        warnPrint("%s has %"PRIu64" blocks, writing as many parts\n",
+                g_args.split_filename, index->num_blocks);
+        num_parts = index->num_blocks;
+    }
+
+    double total = g_args.split_by_records?index->records:0;
+    for (uint64_t b = 0; (!g_args.split_by_records) && (b < index->num_blocks); b++) {
+        total += index->blocks[b].size;
+    }
+
+    /* part names: -o or the input without .avro, then .<n>.avro */
+    char base[PATH_MAX];
+    size_t base_len;
+    tstrncpy(base, g_args.output_filename[0]?g_args.output_filename
+            :g_args.split_filename, sizeof(base));
+    base_len = strlen(base);
+    if ((base_len > 5) && (0 == strcmp(base + base_len - 5, ".avro"))) {
+        base[base_len - 5] = '\0';
+    }
+
+    SplitPart *parts = calloc(num_parts, sizeof(SplitPart));
+    assert(parts);
+    uint64_t first = 0;
+    for (int p = 0; p < num_parts; p++) {
+        SplitPart *part = &parts[p];
+        uint64_t end = (p == num_parts - 1)?index->num_blocks
+            :split_cut(index, g_args.split_by_records, total * (p + 1) / num_parts,
+                    first + 1, index->num_blocks - (num_parts - p - 1));
+
+        part->first_block = first;
+        part->end_block = end;
+        first = end;
+
+        snprintf(part->path, sizeof(part->path), "%s.%d.avro", base, p);
+        generate_sync_marker(part->sync);
+        part->fp = fopen(part->path, "wb");
+        if ((NULL == part->fp)
+                || write_container_header(part->fp, container.schema,
+                    container.codec, part->sync)) {
+            errorPrint("There was an error creating %s\n", part->path);
+            rval = -1;
+            break;
+        }
+    }
+
+    if (0 == rval) {
+        SplitContext ctx = { &container, index };
+        int threads = copy_threads();
+        if ((g_args.threads <= 1) && (threads > num_parts)) {
+            threads = num_parts;
+        }
+
+        OrderedPool *pool = pool_create(threads, split_copy_part, &ctx);
+        for (int p = 0; p < num_parts; p++) {
+            if ((uint64_t)p >= pool->capacity) {
+                rval |= split_report(pool_next_done(pool));
+            }
+            pool_submit(pool, &parts[p]);
+        }
+        pool_close(pool);
+        SplitPart *done;
+        while (NULL != (done = pool_next_done(pool))) {
+            rval |= split_report(done);
+        }
+        pool_destroy(pool);
+    } else {
+        for (int p = 0; p < num_parts; p++) {
+            if (parts[p].fp) {
+                fclose(parts[p].fp);
+            }
+        }
+    }
+
+    free(parts);
+    free_block_index(index);
+    close_container(&container);
+    return rval;
+}
+
+typedef struct RecompressBlock_S {
+    char        *data;          // block as stored in the input
+    size_t      data_len;
+    char        *decoded;
+    size_t      decoded_len;
+    size_t      decoded_cap;
+    char        *block;         // block in the new codec
+    size_t      block_len;
+    size_t      block_cap;
+    int64_t     records;
+    int         error;
+} RecompressBlock;
+
+typedef struct RecompressContext_S {
+    CodecType       from;
+    CodecType       to;
+    int             level;
+    FILE            *fp;
+    char            sync[AVRO_SYNC_SIZE];
+    OrderedPool     *pool;
+    uint64_t        records;
+    uint64_t        blocks;
+    uint64_t        bytes;
+    bool            failed;
+} RecompressContext;
+
+static void free_recompress_block(RecompressBlock *block)
+{
+    free(block->data);
+    free(block->decoded);
+    free(block->block);
+    free(block);
+}
+
+/* worker: decompress one block and compress it with the new codec */
+static void recompress_block(void *job, int thread_idx, void *arg)
+{
+    RecompressContext *ctx = arg;
+    RecompressBlock *block = job;
+    uint64_t t = perf_now();
+
+    if (codec_decompress(ctx->from, block->data, block->data_len,
+                &block->decoded, &block->decoded_cap, &block->decoded_len)) {
+        block->error = -1;
+        return;
+    }
+    perf_lap(NULL, PERF_DECOMPRESS, &t);
+    if (codec_compress(ctx->to, ctx->level, block->decoded, block->decoded_len,
+                &block->block, &block->block_cap, &block->block_len)) {
+        block->error = -1;
+    }
+    perf_lap(NULL, PERF_COMPRESS, &t);
+}
+
+/* single writer: write the blocks in input order */
+static void *recompress_writer_thread(void *arg)
+{
+    RecompressContext *ctx = arg;
+    RecompressBlock *block;
+
+    while (NULL != (block = pool_next_done(ctx->pool))) {
+        uint64_t t = perf_now();
+
+        if (ctx->failed) {
+            // drain the blocks still in flight
+        } else if (block->error) {
+            errorPrint("%s() LN%d, failed to recompress block %"PRIu64" from %s to %s\n",
+                    __func__, __LINE__, ctx->blocks,
+                    g_codec_names[ctx->from], g_codec_names[ctx->to]);
+            __atomic_store_n(&ctx->failed, true, __ATOMIC_RELEASE);
+        } else if (write_container_block(ctx->fp, block->records,
+                    block->block, block->block_len, ctx->sync)) {
+            errorPrint("%s() LN%d, failed to write block to %s\n",
+                    __func__, __LINE__, g_args.recompress_output);
+            __atomic_store_n(&ctx->failed, true, __ATOMIC_RELEASE);
+        } else {
+            ctx->records += block->records;
+            ctx->blocks ++;
+            ctx->bytes += block->block_len;
+            perf_count(block->records, 0, block->data_len, block->block_len);
+        }
+        perf_lap(NULL, PERF_WRITE, &t);
+        free_recompress_block(block);
+    }
+    return NULL;
+}
+
+/* --recompress: each block is decompressed and compressed again with
+ * --codec on all cpus, or -j threads, and written in order. Records are
+ * not decoded and the blocks keep their records, so block boundaries
+ * and the schema stay as they were. */
+static int recompress_avro_file()
+{
+    ContainerReader container;
+    RecompressContext ctx;
+    int threads = copy_threads();
+    struct stat in_st, out_st;
+    int rval = 0;
+
+    if (!g_args.codec_given) {
+        errorPrint("%s", "--recompress needs --codec\n");
+        return -1;
+    }
+    if ((!is_stdio(g_args.recompress_output))
+            && (0 == stat(g_args.recompress_input, &in_st))
+            && (0 == stat(g_args.recompress_output, &out_st))
+            && (in_st.st_dev == out_st.st_dev) && (in_st.st_ino == out_st.st_ino)) {
+        errorPrint("%s is both the input and the output\n", g_args.recompress_input);
+        return -1;
+    }
+    if (open_container(g_args.recompress_input, &container)) {
+        return -1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.from = container.codec;
+    ctx.to = codec_from_name(g_args.codec);
+    ctx.level = (g_args.level >= 0)?g_args.level:codec_default_level(ctx.to);
+    generate_sync_marker(ctx.sync);
+
+    if (is_stdio(g_args.recompress_output)) {
+        ctx.fp = stdout;
+    } else {
+        char stats_file[PATH_MAX];
+        stats_path(g_args.recompress_output, stats_file, sizeof(stats_file));
+        remove(stats_file);
+        ctx.fp = fopen(g_args.recompress_output, "wb");
+    }
+    if ((NULL == ctx.fp)
+            || write_container_header(ctx.fp, container.schema, ctx.to, ctx.sync)) {
+        errorPrint("There was an error creating %s\n", g_args.recompress_output);
+        if (ctx.fp && (stdout != ctx.fp)) {
+            fclose(ctx.fp);
+        }
+        close_container(&container);
+        return -1;
+    }
+
+    pthread_t writer_thread;
+    ctx.pool = pool_create(threads, recompress_block, &ctx);
+    pthread_create(&writer_thread, NULL, recompress_writer_thread, &ctx);
+
+    uint64_t read_bytes = 0;
+    while (!__atomic_load_n(&ctx.failed, __ATOMIC_ACQUIRE)) {
+        int64_t records, size;
+        int ret = read_block_header(&container, &records, &size);
+        if (1 == ret) {
+            break;
+        }
+
+        RecompressBlock *block = calloc(1, sizeof(RecompressBlock));
+        assert(block);
+        if (0 == ret) {
+            block->data = malloc(size?size:1);
+            assert(block->data);
+            ret = read_block_data(&container, block->data, size);
+        }
+        if (ret) {
+            errorPrint("%s() LN%d, corrupted block at byte %"PRIu64" of the block data\n",
+                    __func__, __LINE__, read_bytes);
+            free_recompress_block(block);
+            rval = -1;
+            break;
+        }
+        block->data_len = size;
+        block->records = records;
+        read_bytes += size;
+        pool_submit(ctx.pool, block);
+    }
+
+    pool_close(ctx.pool);
+    pthread_join(writer_thread, NULL);
+    pool_destroy(ctx.pool);
+    close_container(&container);
+
+    if (ctx.failed) {
+        rval = -1;
+    }
+    if ((stdout == ctx.fp)?fflush(ctx.fp):fclose(ctx.fp)) {
+        errorPrint("%s() LN%d, failed to close %s\n",
+                __func__, __LINE__, g_args.recompress_output);
+        rval = -1;
+    }
+    if (0 == rval) {
+        okPrint("%"PRIu64" records in %"PRIu64" blocks, %"PRIu64" bytes of %s"
+                " blocks written as %"PRIu64" bytes of %s\n",
+                ctx.records, ctx.blocks, read_bytes, g_codec_names[ctx.from],
+                ctx.bytes, g_codec_names[ctx.to]);
+    }
+    return rval;
+}
+
+/* CSV input: regular files are memory-mapped and handed out as slices
+ * of the mapping, anything else (pipes, fifos, ttys) is read into a
+ * sliding buffer */
+typedef struct CsvSource_S {
+    int         fd;
+    char        *data;
+    size_t      size;       // bytes available in data
+    size_t      pos;        // start of the next line
+    size_t      cap;        // buffer capacity when not mapped
+    bool        mapped;
+    bool        eof;
+} CsvSource;
+
+static int csv_open(const char *path, CsvSource *src)
+{
+    struct stat st;
+
+    memset(src, 0, sizeof(CsvSource));
+    src->fd = is_stdio(path)?STDIN_FILENO:open(path, O_RDONLY);
+    if (src->fd < 0) {
+        return -1;
+    }
+
+    if ((0 == fstat(src->fd, &st)) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        src->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+        if (MAP_FAILED != src->data) {
+            madvise(src->data, st.st_size, MADV_SEQUENTIAL);
+            src->size = st.st_size;
+            src->mapped = true;
+            src->eof = true;
+            return 0;
+        }
+        src->data = NULL;
+    }
+
+    return 0;
+}
+
+static void csv_close(CsvSource *src)
+{
+    if (src->mapped) {
+        munmap(src->data, src->size);
+    } else {
+        free(src->data);
+    }
+    if (src->fd >= 0) {
+        close(src->fd);
+    }
+    memset(src, 0, sizeof(CsvSource));
+    src->fd = -1;
+}
+
+/* make at least need unread bytes available unless the input ends first,
+ * this moves the unread bytes to the front of the buffer */
+static void csv_fill(CsvSource *src, size_t need)
+{
+    if (src->eof || (src->size - src->pos >= need)) {
+        return;
+    }
+
+    memmove(src->data, src->data + src->pos, src->size - src->pos);
+    src->size -= src->pos;
+    src->pos = 0;
+    ensure_buffer(&src->data, &src->cap, need);
+
+    while ((src->size < need) && (!src->eof)) {
+        ssize_t n = read(src->fd, src->data + src->size, src->cap - src->size);
+        if (n > 0) {
+            src->size += n;
+        } else if ((n < 0) && (EINTR == errno)) {
+            continue;
+        } else {
+            if (n < 0) {
+                errorPrint("%s() LN%d, read error: %s\n",
+                        __func__, __LINE__, strerror(errno));
+            }
+            src->eof = true;
+        }
+    }
+}
+
+/* next line in [*p, end) without its line terminator */
+static bool next_line(
+        const char **p, const char *end,
+        const char **line, size_t *len)
+{
+    if (*p >= end) {
+        return false;
+    }
+
+    const char *nl = memchr(*p, '\n', end - *p);
+    const char *stop = nl?nl:end;
+
+    *line = *p;
+    *len = stop - *p;
+    if ((*len > 0) && ('\r' == (*line)[*len - 1])) {
+        (*len) --;
+    }
+    *p = nl?(nl + 1):end;
+    return true;
+}
+
+/* next run of whole lines of at least target bytes, or the rest of the
+ * input; it points into the mapping when src->mapped, otherwise it is
+ * only valid until the next call */
+static bool csv_next_chunk(
+        CsvSource *src, size_t target,
+        const char **chunk, size_t *len)
+{
+    for (;;) {
+        size_t avail = src->size - src->pos;
+        const char *start = src->data + src->pos;
+
+        if (avail > target) {
+            const char *nl = memchr(start + target, '\n', avail - target);
+            if (nl) {
+                *chunk = start;
+                *len = nl + 1 - start;
+                src->pos += *len;
+                return true;
+            }
+        }
+        if (src->eof) {
+            if (0 == avail) {
+                return false;
+            }
+            *chunk = start;
+            *len = avail;
+            src->pos = src->size;
+            return true;
+        }
+        csv_fill(src, ((avail > target)?avail:target) + CSV_READ_SIZE);
+    }
+}
+
+/* give back the chunk just returned by csv_next_chunk() */
+static void csv_unread_chunk(CsvSource *src, size_t len)
+{
+    src->pos -= len;
+}
+
+typedef struct FieldSlice_S {
+    const char  *ptr;
+    size_t      len;
+    bool        quoted;
+    bool        unescaped;      // ptr is in the tokenizer's buffer
+} FieldSlice;
+
+/* CSV tokenizer: the record is classified CSV_BLOCK_SIZE bytes at a time
+ * into a bit mask of delimiters, quotes, escapes and newlines, and only
+ * the set bits are walked by the state machine below */
+typedef struct CsvTokenizer_S CsvTokenizer;
+
+typedef uint32_t (*CsvClassifyFn)(const CsvTokenizer *tok, const char *p);
+
+struct CsvTokenizer_S {
+    char            delimiter;
+    char            escape;         // '\\' or 0 for doubled quotes
+    bool            is_quote[256];
+    bool            is_special[256];
+    char            needles[CSV_MAX_QUOTES + 3];
+    int             num_needles;
+    CsvClassifyFn   classify;
+    char            *unescaped;     // escaped fields are rebuilt here
+    size_t          unescaped_len;
+    size_t          unescaped_cap;
+};
+
+typedef struct CsvRecord_S {
+    int     fields;         // fields found in the record
+    bool    empty;
+    bool    malformed;      // unterminated quote or text after a quote
+} CsvRecord;
+
+static uint32_t csv_classify_scalar(const CsvTokenizer *tok, const char *p)
+{
+    uint32_t mask = 0;
+
+    for (int i = 0; i < CSV_BLOCK_SIZE; i++) {
+        if (tok->is_special[(unsigned char)p[i]]) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static uint32_t csv_classify_sse2(const CsvTokenizer *tok, const char *p)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i *)p);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i mlo = _mm_setzero_si128();
+    __m128i mhi = _mm_setzero_si128();
+
+    for (int i = 0; i < tok->num_needles; i++) {
+        __m128i needle = _mm_set1_epi8(tok->needles[i]);
+        mlo = _mm_or_si128(mlo, _mm_cmpeq_epi8(lo, needle));
+        mhi = _mm_or_si128(mhi, _mm_cmpeq_epi8(hi, needle));
+    }
+    return (uint32_t)_mm_movemask_epi8(mlo)
+        | ((uint32_t)_mm_movemask_epi8(mhi) << 16);
+}
+
+__attribute__((target("avx2")))
+static uint32_t csv_classify_avx2(const CsvTokenizer *tok, const char *p)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m = _mm256_setzero_si256();
+
+    for (int i = 0; i < tok->num_needles; i++) {
+        m = _mm256_or_si256(m,
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(tok->needles[i])));
+    }
+    return (uint32_t)_mm256_movemask_epi8(m);
+}
+#endif
+
+typedef struct CsvClassifier_S {
+    const char      *name;
+    CsvClassifyFn   classify;
+} CsvClassifier;
+
+/* fastest first */
+static const CsvClassifier g_csv_classifiers[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    { "avx2",   csv_classify_avx2 },
+    { "sse2",   csv_classify_sse2 },
+#endif
+    { "scalar", csv_classify_scalar },
+};
+
+#define CSV_NUM_CLASSIFIERS \
+    (sizeof(g_csv_classifiers) / sizeof(g_csv_classifiers[0]))
+
+static bool csv_classifier_supported(const CsvClassifier *c)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (0 == strcmp(c->name, "avx2")) {
+        return __builtin_cpu_supports("avx2");
+    } else if (0 == strcmp(c->name, "sse2")) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return true;
+}
+
+static void csv_tokenizer_init(CsvTokenizer *tok)
+{
+    memset(tok, 0, sizeof(CsvTokenizer));
+    tok->delimiter = ',';
+    tok->escape = g_args.backslash_escape?'\\':0;
+
+    tok->needles[tok->num_needles++] = tok->delimiter;
+    tok->needles[tok->num_needles++] = '\n';
+    for (const char *q = g_args.quotes; *q; q++) {
+        tok->is_quote[(unsigned char)*q] = true;
+        tok->needles[tok->num_needles++] = *q;
+    }
+    if (tok->escape) {
+        tok->needles[tok->num_needles++] = tok->escape;
+    }
+    for (int i = 0; i < tok->num_needles; i++) {
+        tok->is_special[(unsigned char)tok->needles[i]] = true;
+    }
+
+    for (int i = 0; i < CSV_NUM_CLASSIFIERS; i++) {
+        if (csv_classifier_supported(&g_csv_classifiers[i])) {
+            tok->classify = g_csv_classifiers[i].classify;
+            break;
+        }
+    }
+}
+
+static void csv_tokenizer_free(CsvTokenizer *tok)
+{
+    free(tok->unescaped);
+    tok->unescaped = NULL;
+    tok->unescaped_cap = 0;
+}
+
+static bool csv_is_space(char c)
+{
+    return (' ' == c) || ('\t' == c) || ('\r' == c);
+}
+
+static void csv_unescape_append(CsvTokenizer *tok, const char *p, size_t len)
+{
+    ensure_buffer(&tok->unescaped, &tok->unescaped_cap,
+            tok->unescaped_len + len);
+    memcpy(tok->unescaped + tok->unescaped_len, p, len);
+    tok->unescaped_len += len;
+}
+
+typedef struct CsvFieldState_S {
+    const char  *start;     // raw start of the field
+    const char  *content;   // first byte inside the quotes
+    const char  *seg;       // start of the text not yet unescaped
+    const char  *close;     // closing quote
+    size_t      esc_off;    // offset of the field in tok->unescaped
+    char        quote;
+    bool        escaped;
+} CsvFieldState;
+
+static void csv_emit_field(
+        CsvTokenizer *tok, CsvFieldState *fs, const char *stop,
+        FieldSlice *words, int num_words, CsvRecord *rec)
+{
+    FieldSlice word;
+
+    if (fs->quote) {
+        const char *after = fs->close?(fs->close + 1):stop;
+        for (const char *c = after; c < stop; c++) {
+            if (!csv_is_space(*c)) {
+                rec->malformed = true;
+                break;
+            }
+        }
+        if (NULL == fs->close) {
+            rec->malformed = true;
+            fs->close = stop;
+        }
+        if (fs->escaped) {
+            csv_unescape_append(tok, fs->seg, fs->close - fs->seg);
+            word.ptr = (const char *)(uintptr_t)fs->esc_off;
+            word.len = tok->unescaped_len - fs->esc_off;
+        } else {
+            word.ptr = fs->content;
+            word.len = fs->close - fs->content;
+        }
+        word.quoted = true;
+    } else {
+        const char *start = fs->start;
+        while ((start < stop) && csv_is_space(*start)) {
+            start ++;
+        }
+        while ((stop > start) && csv_is_space(stop[-1])) {
+            stop --;
+        }
+        word.ptr = start;
+        word.len = stop - start;
+        word.quoted = false;
+    }
+
+    word.unescaped = fs->escaped;
+    if (rec->fields < num_words) {
+        words[rec->fields] = word;
+    }
+    rec->fields ++;
+    memset(fs, 0, sizeof(CsvFieldState));
+}
+
+/* Tokenize the record starting at p into at most num_words fields and
+ * return the start of the next record. A record ends at the first
+ * newline that is not inside quotes, or at end. Quoted fields may hold
+ * delimiters and escaped quotes but not newlines. Whitespace around
+ * fields is dropped, missing fields are returned empty. */
+static const char *csv_tokenize(
+        CsvTokenizer *tok, const char *p, const char *end,
+        FieldSlice *words, int num_words, CsvRecord *rec)
+{
+    CsvFieldState fs;
+    const char *skip = p;       // bytes before this were consumed by escapes
+    const char *stop = end;     // end of the record text
+    const char *next = end;     // start of the next record
+    char tail[CSV_BLOCK_SIZE];
+
+    memset(rec, 0, sizeof(CsvRecord));
+    memset(&fs, 0, sizeof(fs));
+    fs.start = p;
+    tok->unescaped_len = 0;
+
+    for (const char *blk = p; blk < end; blk += CSV_BLOCK_SIZE) {
+        uint32_t mask;
+
+        if (end - blk >= CSV_BLOCK_SIZE) {
+            mask = tok->classify(tok, blk);
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, blk, end - blk);
+            mask = csv_classify_scalar(tok, tail)
+                & ((1U << (end - blk)) - 1);
+        }
+
+        while (mask) {
+            const char *c = blk + __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            if (c < skip) {
+                continue;
+            }
+
+            if (0 == fs.quote) {
+                if (tok->delimiter == *c) {
+                    csv_emit_field(tok, &fs, c, words, num_words, rec);
+                    fs.start = c + 1;
+                } else if ('\n' == *c) {
+                    stop = c;
+                    next = c + 1;
+                    goto record_end;
+                } else if (tok->is_quote[(unsigned char)*c]) {
+                    const char *q = fs.start;
+                    while ((q < c) && csv_is_space(*q)) {
+                        q ++;
+                    }
+                    if (q == c) {
+                        fs.quote = *c;
+                        fs.content = fs.seg = c + 1;
+                    }
+                }
+            } else if (fs.close) {
+                /* text after the closing quote */
+                if (tok->delimiter == *c) {
+                    csv_emit_field(tok, &fs, c, words, num_words, rec);
+                    fs.start = c + 1;
+                } else if ('\n' == *c) {
+                    stop = c;
+                    next = c + 1;
+                    goto record_end;
+                }
+            } else if (fs.quote == *c) {
+                if ((0 == tok->escape) && (c + 1 < end) && (fs.quote == c[1])) {
+                    if (!fs.escaped) {
+                        fs.escaped = true;
+                        fs.esc_off = tok->unescaped_len;
+                    }
+                    csv_unescape_append(tok, fs.seg, c + 1 - fs.seg);
+                    fs.seg = skip = c + 2;
+                } else {
+                    fs.close = c;
+                }
+            } else if (tok->escape && (tok->escape == *c) && (c + 1 < end)) {
+                if (!fs.escaped) {
+                    fs.escaped = true;
+                    fs.esc_off = tok->unescaped_len;
+                }
+                csv_unescape_append(tok, fs.seg, c - fs.seg);
+                csv_unescape_append(tok, c + 1, 1);
+                fs.seg = skip = c + 2;
+            } else if ('\n' == *c) {
+                /* newline inside quotes, the quote is never closed */
+                stop = c;
+                next = c + 1;
+                goto record_end;
+            }
+        }
+    }
+
+record_end:
+    if ((0 == rec->fields) && (0 == fs.quote)) {
+        const char *c = fs.start;
+        while ((c < stop) && csv_is_space(*c)) {
+            c ++;
+        }
+        if (c == stop) {
+            rec->empty = true;
+            return next;
+        }
+    }
+    csv_emit_field(tok, &fs, stop, words, num_words, rec);
+
+    /* escaped fields hold an offset into tok->unescaped until now,
+     * since the buffer may move while it grows */
+    for (int i = 0; i < num_words; i++) {
+        if (i >= rec->fields) {
+            words[i].ptr = stop;
+            words[i].len = 0;
+            words[i].quoted = false;
+            words[i].unescaped = false;
+        } else if (words[i].unescaped) {
+            words[i].ptr = tok->unescaped + (uintptr_t)words[i].ptr;
+        }
+    }
+
+    return next;
+}
+
+/* The jansson tree of a json field only lives until the field is set,
+ * so its nodes are bumped from an arena of the field and all dropped
+ * at once, instead of a malloc() and free() per node of every row.
+ * jansson's hooks are process wide: t_json_arena is only set while a
+ * field parses, everything else goes to malloc() as before. */
+typedef struct JsonArena_S {
+    char        *buf;
+    size_t      cap;
+    size_t      len;
+    size_t      spilled;    // bytes that didn't fit, to size the next one
+} JsonArena;
+
+#define JSON_ARENA_ALIGN    16
+#define JSON_ARENA_MIN      4096
+
+static __thread JsonArena *t_json_arena;
+
+static void *json_arena_malloc(size_t size)
+{
+    JsonArena *arena = t_json_arena;
+
+    size = (size + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1);
+    if (arena && (arena->len + size <= arena->cap)) {
+        void *p = arena->buf + arena->len;
+        arena->len += size;
+        return p;
+    }
+    if (arena) {
+        arena->spilled += size;
+    }
+    return malloc(size);
+}
+
+static void json_arena_free(void *p)
+{
+    JsonArena *arena = t_json_arena;
+
+    if (arena && ((char *)p >= arena->buf) && ((char *)p < arena->buf + arena->cap)) {
+        return;
+    }
+    free(p);
+}
+
+/* drop everything of the last tree, and grow if it didn't fit */
+static void json_arena_reset(JsonArena *arena)
+{
+    if (arena->spilled) {
+        size_t cap = arena->cap?arena->cap:JSON_ARENA_MIN;
+        while (cap < arena->len + arena->spilled) {
+            cap *= 2;
+        }
+        free(arena->buf);
+        arena->buf = malloc(cap);
+        assert(arena->buf);
+        arena->cap = cap;
+    }
+    arena->len = 0;
+    arena->spilled = 0;
+}
+
+typedef struct WriteField_S WriteField;
+
+typedef int (*FieldSetter)(avro_value_t *value, WriteField *wf, FieldSlice *word);
+
+/* writes the avro binary of the value at p and returns its end */
+typedef char *(*FieldEncoder)(WriteField *wf, FieldSlice *word, char *p);
+
+struct WriteField_S {
+    FieldStruct *field;
+    int         index;          // field position in the avro record
+    int         null_branch;    // union branch of "null", -1 if not nullable
+    int         value_branch;   // union branch holding the value
+    FieldSetter set;            // called with the record's field value
+    FieldSetter set_value;      // called with the non-null value
+    char        *scratch;       // NUL terminated copy of the field
+    size_t      scratch_cap;
+    JsonArena   json_arena;     // of set_json_value()
+    FieldEncoder encode;        // of the value, NULL without a direct encoder
+    size_t      encode_bound;   // most bytes encode writes besides the text
+    ParseStatus status;         // of the last value parsed by set_value
+};
+
+typedef struct WritePlan_S {
+    avro_value_iface_t  *wface;
+    avro_value_t        record;
+    int                 num_fields;
+    WriteField          *fields;
+    FieldSlice          *words;
+    CsvTokenizer        tok;
+    const char          *line;      // raw text of the record, for errors
+    int                 line_len;
+    bool                quiet;      // don't report bad rows
+    bool                direct;     // encode_record_direct() can write it
+} WritePlan;
+
+/* libc converters and avro strings want a terminating NUL, which the
+ * slices into the data file don't have */
+static const char *field_cstr(WriteField *wf, FieldSlice *word)
+{
+    ensure_buffer(&wf->scratch, &wf->scratch_cap, word->len + 1);
+    memcpy(wf->scratch, word->ptr, word->len);
+    wf->scratch[word->len] = '\0';
+    return wf->scratch;
+}
+
+static bool slice_is(FieldSlice *word, const char *str, size_t len)
+{
+    return (word->len == len) && (0 == memcmp(word->ptr, str, len));
+}
+
+/* Strings and bytes are given to the record by reference instead of
+ * being copied into it: the csv text outlives the record, which both
+ * writers encode before the next line is tokenized, and the wrapped
+ * buffer has no free function, so resetting the record leaves the text
+ * alone. The encoder writes the size less one bytes of a string, so
+ * the text needs no NUL. */
+static int set_string_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    avro_wrapped_buffer_t buf;
+
+    avro_wrapped_buffer_new(&buf, word->ptr, word->len + 1);
+    return avro_value_give_string_len(value, &buf);
+}
+
+static int set_bytes_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    avro_wrapped_buffer_t buf;
+
+    avro_wrapped_buffer_new(&buf, word->ptr, word->len);
+    return avro_value_give_bytes(value, &buf);
+}
+
+static ParseStatus parse_field_double(
+        WriteField *wf, FieldSlice *word, double *out)
+{
+    const char *str;
+    char *eptr;
+
+    if (parse_double_fast(word->ptr, word->len, out)) {
+        return PARSE_OK;
+    }
+
+    str = field_cstr(wf, word);
+    errno = 0;
+    *out = strtod(str, &eptr);
+    if ((eptr == str) || ('\0' != *eptr)) {
+        return PARSE_INVALID;
+    }
+    if ((ERANGE == errno) && isinf(*out)) {
+        return PARSE_OVERFLOW;
+    }
+    return PARSE_OK;
+}
+
+/* The parse_*_field() helpers turn the text into what is stored and set
+ * wf->status. The set_*_value() setters store it in an avro value and
+ * the encode_*_value() encoders of the direct path write its binary
+ * form, so both paths write the same values for bad text too. */
+static int64_t parse_long_field(WriteField *wf, FieldSlice *word)
+{
+    int64_t l;
+
+    wf->status = parse_int64(word->ptr, word->len, &l);
+    return l;
+}
+
+static int32_t parse_int_field(WriteField *wf, FieldSlice *word)
+{
+    int64_t l;
+
+    wf->status = parse_int64(word->ptr, word->len, &l);
+    if ((PARSE_OK == wf->status) && ((l < INT32_MIN) || (l > INT32_MAX))) {
+        wf->status = PARSE_OVERFLOW;
+    }
+    return (int32_t)l;
+}
+
+static bool parse_boolean_field(WriteField *wf, FieldSlice *word)
+{
+    int64_t l;
+
+    if ((4 == word->len) && (0 == strncasecmp(word->ptr, "true", 4))) {
+        wf->status = PARSE_OK;
+        l = 1;
+    } else if ((5 == word->len) && (0 == strncasecmp(word->ptr, "false", 5))) {
+        wf->status = PARSE_OK;
+        l = 0;
+    } else {
+        wf->status = parse_int64(word->ptr, word->len, &l);
+    }
+    return l?1:0;
+}
+
+static float parse_float_field(WriteField *wf, FieldSlice *word)
+{
+    double d;
+
+    wf->status = parse_field_double(wf, word, &d);
+    if ((PARSE_OK == wf->status) && isfinite(d) && (fabs(d) > FLT_MAX)) {
+        wf->status = PARSE_OVERFLOW;
+    }
+    return (float)d;
+}
+
+static double parse_double_field(WriteField *wf, FieldSlice *word)
+{
+    double d;
+
+    wf->status = parse_field_double(wf, word, &d);
+    return d;
+}
+
+static uint64_t parse_unsigned_field(WriteField *wf, FieldSlice *word, uint64_t max)
+{
+    uint64_t u;
+
+    wf->status = parse_uint64(word->ptr, word->len, &u);
+    if ((PARSE_OK == wf->status) && (u > max)) {
+        wf->status = PARSE_OVERFLOW;
+    }
+    return u;
+}
+
+static int parse_enum_field(WriteField *wf, FieldSlice *word)
+{
+    int symbol = avro_schema_enum_get_by_name(wf->field->schema,
+            field_cstr(wf, word));
+
+    if (symbol < 0) {
+        wf->status = PARSE_INVALID;
+        symbol = 0;
+    }
+    return symbol;
+}
+
+/* a fixed of the wrong size is padded with zeros or cut */
+static const char *parse_fixed_field(WriteField *wf, FieldSlice *word, size_t size)
+{
+    if (word->len == size) {
+        return word->ptr;
+    }
+
+    wf->status = PARSE_INVALID;
+    ensure_buffer(&wf->scratch, &wf->scratch_cap, size + 1);
+    memset(wf->scratch, 0, size);
+    memcpy(wf->scratch, word->ptr, (word->len < size)?word->len:size);
+    return wf->scratch;
+}
+
+/* date, time and timestamp fields take the number avro stores or the
+ * text print_*_value() shows */
+static int64_t parse_temporal_field(WriteField *wf, FieldSlice *word)
+{
+    int64_t l;
+    int64_t temporal;
+
+    wf->status = parse_int64(word->ptr, word->len, &l);
+    if ((PARSE_INVALID == wf->status)
+            && (PARSE_OK == parse_temporal(wf->field, field_cstr(wf, word), &temporal))) {
+        wf->status = PARSE_OK;
+        l = temporal;
+    }
+    return l;
+}
+
+/* [-]digits[.digits] scaled to the field's scale into wf->scratch, as
+ * the shortest big-endian two's complement, or sign extended to a fixed.
+ * Returns the size. */
+static size_t parse_decimal_field(WriteField *wf, FieldSlice *word, bool is_fixed)
+{
+    __int128 unscaled;
+    unsigned char buf[16];
+    size_t size;
+
+    wf->status = parse_decimal(word->ptr, word->len,
+            wf->field->scale, wf->field->precision, &unscaled);
+
+    for (int i = 15; i >= 0; i--) {
+        buf[i] = (unsigned char)(unscaled & 0xff);
+        unscaled >>= 8;
+    }
+
+    if (is_fixed) {
+        size = avro_schema_fixed_size(wf->field->schema);
+        ensure_buffer(&wf->scratch, &wf->scratch_cap, size + 1);
+        memset(wf->scratch, (buf[0] & 0x80)?0xff:0, size);
+        if (size >= 16) {
+            memcpy(wf->scratch + size - 16, buf, 16);
+        } else {
+            memcpy(wf->scratch, buf + 16 - size, size);
+            if ((PARSE_OK == wf->status)
+                    && ((buf[16 - size] & 0x80) != (buf[0] & 0x80))) {
+                wf->status = PARSE_OVERFLOW;
+            }
+        }
+        return size;
+    }
+
+    /* drop the leading bytes that only repeat the sign */
+    size_t skip = 0;
+    while ((skip < 15)
+            && (((0 == buf[skip]) && (0 == (buf[skip+1] & 0x80)))
+                || ((0xff == buf[skip]) && (buf[skip+1] & 0x80)))) {
+        skip ++;
+    }
+    ensure_buffer(&wf->scratch, &wf->scratch_cap, 16);
+    memcpy(wf->scratch, buf + skip, 16 - skip);
+    return 16 - skip;
+}
+
+static int set_long_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    return avro_value_set_long(value, parse_long_field(wf, word));
+}
+
+static int set_int_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    return avro_value_set_int(value, parse_int_field(wf, word));
+}
+
+static int set_boolean_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    return avro_value_set_boolean(value, parse_boolean_field(wf, word));
+}
+
+static int set_float_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    return avro_value_set_float(value, parse_float_field(wf, word));
+}
+
+static int set_double_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    return avro_value_set_double(value, parse_double_field(wf, word));
+}
+
+/* unsigned values are stored as two items whose sum wraps back to the
+ * original value, see the array branch of read_avro_file() */
+static int set_int_array_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    avro_value_t intv1, intv2;
+    uint64_t u = parse_unsigned_field(wf, word, UINT32_MAX);
+
+    if ((0 != avro_value_append(value, &intv1, NULL))
+            || (0 != avro_value_set_int(&intv1, (int32_t)(u - INT_MAX)))
+            || (0 != avro_value_append(value, &intv2, NULL))) {
+        return -1;
+    }
+    return avro_value_set_int(&intv2, INT_MAX);
+}
+
+static int set_long_array_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    avro_value_t longv1, longv2;
+    uint64_t u = parse_unsigned_field(wf, word, UINT64_MAX);
+
+    if ((0 != avro_value_append(value, &longv1, NULL))
+            || (0 != avro_value_set_long(&longv1, (int64_t)(u - LONG_MAX)))
+            || (0 != avro_value_append(value, &longv2, NULL))) {
+        return -1;
+    }
+    return avro_value_set_long(&longv2, LONG_MAX);
+}
+
+static int set_enum_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    return avro_value_set_enum(value, parse_enum_field(wf, word));
+}
+
+static int set_fixed_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    size_t size = avro_schema_fixed_size(wf->field->schema);
+
+    return avro_value_set_fixed(value, (void *)parse_fixed_field(wf, word, size), size);
+}
+
+static int set_temporal_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    int64_t l = parse_temporal_field(wf, word);
+
+    return (0 == strcmp(wf->field->type, "int"))?avro_value_set_int(value, (int32_t)l)
+        :avro_value_set_long(value, l);
+}
+
+static int set_decimal_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    if (0 == strcmp(wf->field->type, "fixed")) {
+        size_t size = parse_decimal_field(wf, word, true);
+        return avro_value_set_fixed(value, wf->scratch, size);
+    }
+    size_t size = parse_decimal_field(wf, word, false);
+    return avro_value_set_bytes(value, wf->scratch, size);
+}
+
+static bool json_matches_schema(json_t *json, avro_schema_t schema)
+{
+    switch (avro_typeof(resolve_link(schema))) {
+        case AVRO_NULL:
+            return (NULL == json) || json_is_null(json);
+        case AVRO_BOOLEAN:
+            return json_is_boolean(json);
+        case AVRO_INT32:
+        case AVRO_INT64:
+            return json_is_integer(json);
+        case AVRO_FLOAT:
+        case AVRO_DOUBLE:
+            return json_is_number(json);
+        case AVRO_STRING:
+        case AVRO_BYTES:
+        case AVRO_ENUM:
+        case AVRO_FIXED:
+            return json_is_string(json);
+        case AVRO_ARRAY:
+            return json_is_array(json);
+        case AVRO_MAP:
+        case AVRO_RECORD:
+            return json_is_object(json);
+        default:
+            return false;
+    }
+}
+
+/* pick the union branch for json: avro's {"type": value} form when it
+ * names a branch, else the first branch the json fits */
+static int json_union_branch(json_t **json, avro_schema_t schema)
+{
+    size_t branches = avro_schema_union_size(schema);
+
+    if (json_is_object(*json) && (1 == json_object_size(*json))) {
+        const char *key;
+        json_t *inner;
+
+        json_object_foreach(*json, key, inner) {
+            for (size_t b = 0; b < branches; b++) {
+                avro_schema_t branch = resolve_link(avro_schema_union_branch(schema, b));
+                const char *name = (is_avro_record(branch)
+                        || (AVRO_ENUM == avro_typeof(branch))
+                        || (AVRO_FIXED == avro_typeof(branch)))?
+                    avro_schema_name(branch):avro_type_to_name(branch);
+                if (0 == strcmp(key, name)) {
+                    *json = inner;
+                    return b;
+                }
+            }
+        }
+    }
+
+    for (size_t b = 0; b < branches; b++) {
+        if (json_matches_schema(*json, avro_schema_union_branch(schema, b))) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/* set value from json, a missing json is taken as null */
+static int json_to_avro_value(json_t *json, avro_value_t *value)
+{
+    avro_schema_t schema = avro_value_get_schema(value);
+    avro_value_t child;
+
+    switch (avro_value_get_type(value)) {
+        case AVRO_NULL:
+            return ((NULL == json) || json_is_null(json))?
+                avro_value_set_null(value):-1;
+
+        case AVRO_BOOLEAN:
+            return json_is_boolean(json)?
+                avro_value_set_boolean(value, json_is_true(json)):-1;
+
+        case AVRO_INT32:
+            if ((!json_is_integer(json))
+                    || (json_integer_value(json) < INT32_MIN)
+                    || (json_integer_value(json) > INT32_MAX)) {
+                return -1;
+            }
+            return avro_value_set_int(value, (int32_t)json_integer_value(json));
+
+        case AVRO_INT64:
+            return json_is_integer(json)?
+                avro_value_set_long(value, json_integer_value(json)):-1;
+
+        case AVRO_FLOAT:
+            return json_is_number(json)?
+                avro_value_set_float(value, json_number_value(json)):-1;
+
+        case AVRO_DOUBLE:
+            return json_is_number(json)?
+                avro_value_set_double(value, json_number_value(json)):-1;
+
+        case AVRO_STRING:
+            return json_is_string(json)?
+                avro_value_set_string_len(value, json_string_value(json),
+                        json_string_length(json) + 1):-1;
+
+        case AVRO_BYTES:
+            return json_is_string(json)?
+                avro_value_set_bytes(value, (void *)json_string_value(json),
+                        json_string_length(json)):-1;
+
+        case AVRO_FIXED:
+            if ((!json_is_string(json))
+                    || (json_string_length(json) != (size_t)avro_schema_fixed_size(schema))) {
+                return -1;
+            }
+            return avro_value_set_fixed(value, (void *)json_string_value(json),
+                    json_string_length(json));
+
+        case AVRO_ENUM:
+            {
+                int symbol = json_is_string(json)?
+                    avro_schema_enum_get_by_name(schema, json_string_value(json)):-1;
+                return (symbol < 0)?-1:avro_value_set_enum(value, symbol);
+            }
+
+        case AVRO_ARRAY:
+            if (!json_is_array(json)) {
+                return -1;
+            }
+            for (size_t i = 0; i < json_array_size(json); i++) {
+                if (avro_value_append(value, &child, NULL)
+                        || json_to_avro_value(json_array_get(json, i), &child)) {
+                    return -1;
+                }
+            }
+            return 0;
+
+        case AVRO_MAP:
+            {
+                const char *key;
+                json_t *item;
+
+                if (!json_is_object(json)) {
+                    return -1;
+                }
+                json_object_foreach(json, key, item) {
+                    if (avro_value_add(value, key, &child, NULL, NULL)
+                            || json_to_avro_value(item, &child)) {
+                        return -1;
+                    }
+                }
+                return 0;
+            }
+
+        case AVRO_RECORD:
+            {
+                size_t fields;
+
+                if ((!json_is_object(json))
+                        || avro_value_get_size(value, &fields)) {
+                    return -1;
+                }
+                for (size_t i = 0; i < fields; i++) {
+                    const char *name;
+                    if (avro_value_get_by_index(value, i, &child, &name)
+                            || json_to_avro_value(json_object_get(json, name), &child)) {
+                        return -1;
+                    }
+                }
+                return 0;
+            }
+
+        case AVRO_UNION:
+            {
+                int branch = json_union_branch(&json, schema);
+                if ((branch < 0)
+                        || avro_value_set_branch(value, branch, &child)) {
+                    return -1;
+                }
+                return json_to_avro_value(json, &child);
+            }
+
+        default:
+            return -1;
+    }
+}
+
+/* records, maps, unions and arrays other than the unsigned int/long
+ * ones are given as json, e.g. '{"lat": 1.5, "tags": ["a", "b"]}' */
+static int set_json_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    json_error_t error;
+
+    t_json_arena = &wf->json_arena;
+    json_t *json = json_loadb(word->ptr, word->len, JSON_DECODE_ANY, &error);
+
+    if ((NULL == json) || json_to_avro_value(json, value)) {
+        wf->status = PARSE_INVALID;
+    }
+    if (json) {
+        json_decref(json);
+    }
+    t_json_arena = NULL;
+    json_arena_reset(&wf->json_arena);
+    return 0;
+}
+
+static int set_nullable_value(avro_value_t *value, WriteField *wf, FieldSlice *word)
+{
+    avro_value_t branch;
+
+    if ((!word->quoted) && slice_is(word, "null", 4)) {
+        if (avro_value_set_branch(value, wf->null_branch, &branch)) {
+            return -1;
+        }
+        return avro_value_set_null(&branch);
+    }
+
+    if (avro_value_set_branch(value, wf->value_branch, &branch)) {
+        return -1;
+    }
+    return wf->set_value(&branch, wf, word);
+}
+
+static FieldSetter get_logical_setter(FieldStruct *field)
+{
+    const char *logical = field->logical_type;
+
+    if (((0 == strcmp(field->type, "int"))
+                && ((0 == strcmp(logical, "date"))
+                    || (0 == strcmp(logical, "time-millis"))))
+            || ((0 == strcmp(field->type, "long"))
+                && ((0 == strcmp(logical, "time-micros"))
+                    || (NULL != strstr(logical, "timestamp-"))))) {
+        return set_temporal_value;
+    } else if (((0 == strcmp(field->type, "bytes"))
+                || (0 == strcmp(field->type, "fixed")))
+            && (0 == strcmp(logical, "decimal"))) {
+        return set_decimal_value;
+    }
+
+    return NULL;
+}
+
+static FieldSetter get_field_setter(FieldStruct *field)
+{
+    FieldSetter setter = get_logical_setter(field);
+
+    if (setter) {
+        return setter;
+    } else if (0 == strcmp(field->type, "string")) {
+        return set_string_value;
+    } else if (0 == strcmp(field->type, "bytes")) {
+        return set_bytes_value;
+    } else if (0 == strcmp(field->type, "long")) {
+        return set_long_value;
+    } else if (0 == strcmp(field->type, "int")) {
+        return set_int_value;
+    } else if (0 == strcmp(field->type, "boolean")) {
+        return set_boolean_value;
+    } else if (0 == strcmp(field->type, "float")) {
+        return set_float_value;
+    } else if (0 == strcmp(field->type, "double")) {
+        return set_double_value;
+    } else if (0 == strcmp(field->type, "enum")) {
+        return set_enum_value;
+    } else if (0 == strcmp(field->type, "fixed")) {
+        return set_fixed_value;
+    } else if ((0 == strcmp(field->type, "array"))
+            && (0 == strcmp(field->array_type, "int"))) {
+        return set_int_array_value;
+    } else if ((0 == strcmp(field->type, "array"))
+            && (0 == strcmp(field->array_type, "long"))) {
+        return set_long_array_value;
+    } else if ((0 == strcmp(field->type, "array"))
+            || (0 == strcmp(field->type, "map"))
+            || (0 == strcmp(field->type, "record"))
+            || (0 == strcmp(field->type, "union"))) {
+        return set_json_value;
+    }
+
+    return NULL;
+}
+
+/* Encoders of the direct path, which writes the avro binary of a record
+ * straight from the csv fields instead of setting a generic value and
+ * having avro_value_write() walk it. They write what avro_value_write()
+ * writes for the value the setter of the field sets. */
+#define DIRECT_FIELD_SLACK  48      // union index, length, decimal, pair
+
+static char *encode_raw(char *p, const void *data, size_t len)
+{
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static char *encode_len_bytes(char *p, const void *data, size_t len)
+{
+    p += encode_long(p, len);
+    return encode_raw(p, data, len);
+}
+
+/* little-endian like avro's encoder */
+static char *encode_le(char *p, uint64_t bits, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        *p++ = (char)(bits >> (8 * i));
+    }
+    return p;
+}
+
+static char *encode_string_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    return encode_len_bytes(p, word->ptr, word->len);
+}
+
+static char *encode_long_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    return p + encode_long(p, parse_long_field(wf, word));
+}
+
+static char *encode_int_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    return p + encode_long(p, parse_int_field(wf, word));
+}
+
+static char *encode_boolean_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    *p = parse_boolean_field(wf, word)?1:0;
+    return p + 1;
+}
+
+static char *encode_float_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    float f = parse_float_field(wf, word);
+    uint32_t bits;
+
+    memcpy(&bits, &f, sizeof(bits));
+    return encode_le(p, bits, sizeof(bits));
+}
+
+static char *encode_double_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    double d = parse_double_field(wf, word);
+    uint64_t bits;
+
+    memcpy(&bits, &d, sizeof(bits));
+    return encode_le(p, bits, sizeof(bits));
+}
+
+/* one block of the two items, then the empty block that ends an array */
+static char *encode_int_array_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    uint64_t u = parse_unsigned_field(wf, word, UINT32_MAX);
+
+    p += encode_long(p, 2);
+    p += encode_long(p, (int32_t)(u - INT_MAX));
+    p += encode_long(p, INT_MAX);
+    return p + encode_long(p, 0);
+}
+
+static char *encode_long_array_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    uint64_t u = parse_unsigned_field(wf, word, UINT64_MAX);
+
+    p += encode_long(p, 2);
+    p += encode_long(p, (int64_t)(u - LONG_MAX));
+    p += encode_long(p, LONG_MAX);
+    return p + encode_long(p, 0);
+}
+
+static char *encode_enum_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    return p + encode_long(p, parse_enum_field(wf, word));
+}
+
+static char *encode_fixed_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    size_t size = avro_schema_fixed_size(wf->field->schema);
+
+    return encode_raw(p, parse_fixed_field(wf, word, size), size);
+}
+
+static char *encode_temporal_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    int64_t l = parse_temporal_field(wf, word);
+
+    return p + encode_long(p, (0 == strcmp(wf->field->type, "int"))?(int32_t)l:l);
+}
+
+static char *encode_decimal_value(WriteField *wf, FieldSlice *word, char *p)
+{
+    if (0 == strcmp(wf->field->type, "fixed")) {
+        size_t size = parse_decimal_field(wf, word, true);
+        return encode_raw(p, wf->scratch, size);
+    }
+    size_t size = parse_decimal_field(wf, word, false);
+    return encode_len_bytes(p, wf->scratch, size);
+}
+
+/* json fields, records, maps and other unions have none */
+static FieldEncoder get_field_encoder(FieldSetter setter)
+{
+    if ((set_string_value == setter) || (set_bytes_value == setter)) {
+        return encode_string_value;
+    } else if (set_long_value == setter) {
+        return encode_long_value;
+    } else if (set_int_value == setter) {
+        return encode_int_value;
+    } else if (set_boolean_value == setter) {
+        return encode_boolean_value;
+    } else if (set_float_value == setter) {
+        return encode_float_value;
+    } else if (set_double_value == setter) {
+        return encode_double_value;
+    } else if (set_int_array_value == setter) {
+        return encode_int_array_value;
+    } else if (set_long_array_value == setter) {
+        return encode_long_array_value;
+    } else if (set_enum_value == setter) {
+        return encode_enum_value;
+    } else if (set_fixed_value == setter) {
+        return encode_fixed_value;
+    } else if (set_temporal_value == setter) {
+        return encode_temporal_value;
+    } else if (set_decimal_value == setter) {
+        return encode_decimal_value;
+    }
+
+    return NULL;
+}
+
+static void freeWritePlan(WritePlan *plan)
+{
+    if (plan) {
+        if (plan->wface) {
+            avro_value_decref(&plan->record);
+            avro_value_iface_decref(plan->wface);
+        }
+        for (int i = 0; i < plan->num_fields; i++) {
+            free(plan->fields[i].scratch);
+            free(plan->fields[i].json_arena.buf);
+        }
+        free(plan->fields);
+        free(plan->words);
+        csv_tokenizer_free(&plan->tok);
+        free(plan);
+    }
+}
+
+/* resolve field positions, union branches and setters once per schema,
+ * so that the per-row work is only parsing and setting values */
+static WritePlan *compile_write_plan(
+        avro_schema_t schema,
+        RecordSchema *recordSchema)
+{
+    WritePlan *plan = calloc(1, sizeof(WritePlan));
+    assert(plan);
+
+    plan->num_fields = recordSchema->num_fields;
+    plan->fields = calloc(recordSchema->num_fields, sizeof(WriteField));
+    assert(plan->fields);
+    plan->words = calloc(recordSchema->num_fields, sizeof(FieldSlice));
+    assert(plan->words);
+    csv_tokenizer_init(&plan->tok);
+
+    for (int i = 0; i < recordSchema->num_fields; i++) {
+        FieldStruct *field = (FieldStruct *)(recordSchema->fields + sizeof(FieldStruct) * i);
+        WriteField *wf = &plan->fields[i];
+
+        wf->field = field;
+        wf->index = avro_schema_record_field_get_index(schema, field->name);
+        if (wf->index < 0) {
+            errorPrint("%s() LN%d, field %s is not found in schema\n",
+                    __func__, __LINE__, field->name);
+            freeWritePlan(plan);
+            return NULL;
+        }
+
+        wf->set_value = get_field_setter(field);
+        if (NULL == wf->set_value) {
+            errorPrint("%s() LN%d, type %s of field %s is not supported!\n",
+                    __func__, __LINE__, field->type, field->name);
+            freeWritePlan(plan);
+            return NULL;
+        }
+
+        resolve_union_branches(
+                avro_schema_record_field_get_by_index(schema, wf->index),
+                &wf->null_branch, &wf->value_branch);
+
+        if (field->nullable && (wf->null_branch >= 0) && (wf->value_branch >= 0)) {
+            wf->set = set_nullable_value;
+        } else {
+            wf->set = wf->set_value;
+        }
+
+        wf->encode = get_field_encoder(wf->set_value);
+        wf->encode_bound = DIRECT_FIELD_SLACK;
+        if ((0 == strcmp(field->type, "fixed")) && field->schema) {
+            wf->encode_bound += avro_schema_fixed_size(field->schema);
+        }
+    }
+
+    /* the direct path writes the fields in csv order, which has to be
+     * the order of the record, and unions only of null and the value */
+    plan->direct = (!g_args.generic_encode)
+        && (recordSchema->num_fields == (int)avro_schema_record_size(schema));
+    for (int i = 0; plan->direct && (i < plan->num_fields); i++) {
+        WriteField *wf = &plan->fields[i];
+        bool is_union = is_avro_union(
+                avro_schema_record_field_get_by_index(schema, wf->index));
+        plan->direct = (NULL != wf->encode) && (wf->index == i)
+            && (is_union == (set_nullable_value == wf->set));
+    }
+
+    plan->wface = avro_generic_class_from_schema(schema);
+    if ((NULL == plan->wface)
+            || avro_generic_value_new(plan->wface, &plan->record)) {
+        errorPrint("%s() LN%d, Unable to create record value. Message: %s\n",
+                __func__, __LINE__, avro_strerror());
+        if (plan->wface) {
+            avro_value_iface_decref(plan->wface);
+            plan->wface = NULL;
+        }
+        freeWritePlan(plan);
+        return NULL;
+    }
+
+    return plan;
+}
+
+/* tokenize the record at p into plan->words,
+ * returns the start of the next record */
+static const char *next_record(
+        WritePlan *plan, const char *p, const char *end, CsvRecord *rec)
+{
+    const char *next = csv_tokenize(&plan->tok, p, end,
+            plan->words, plan->num_fields, rec);
+    int len = (int)(next - p);
+
+    while ((len > 0) && (('\n' == p[len-1]) || ('\r' == p[len-1]))) {
+        len --;
+    }
+    plan->line = p;
+    plan->line_len = len;
+    if (plan->quiet) {
+        return next;
+    }
+    if (g_args.debug_output && (!rec->empty)) {
+        fprintf(report_stream(), "%.*s\n", len, p);
+    }
+    if (rec->malformed) {
+        errorPrint("%s() LN%d, malformed quotes in: %.*s\n",
+                __func__, __LINE__, len, p);
+    }
+    return next;
+}
+
+/* build_record() results besides 0 */
+#define RECORD_FAILED       -1      // count the row as failed and go on
+#define RECORD_ABORT        -2      // --on-error fail, stop writing
+#define RECORD_NULL         1       // of field_parse_error(), write null
+
+static void report_parse_error(
+        WritePlan *plan, WriteField *wf, FieldSlice *word, const char *action)
+{
+    if (plan->quiet) {
+        return;
+    }
+    if (ON_ERROR_FAIL == g_args.on_error) {
+        errorPrint("field %s: %s value \"%.*s\"%s in: %.*s\n",
+                wf->field->name, g_parse_status_names[wf->status],
+                (int)word->len, word->ptr, action,
+                plan->line_len, plan->line);
+    } else {
+        warnPrint("field %s: %s value \"%.*s\"%s in: %.*s\n",
+                wf->field->name, g_parse_status_names[wf->status],
+                (int)word->len, word->ptr, action,
+                plan->line_len, plan->line);
+    }
+}
+
+/* apply --on-error to a field whose text didn't parse, RECORD_NULL
+ * when the caller is to write null into it */
+static int field_parse_error(WritePlan *plan, WriteField *wf, FieldSlice *word)
+{
+    switch (g_args.on_error) {
+        case ON_ERROR_WARN:
+            report_parse_error(plan, wf, word, "");
+            return 0;
+
+        case ON_ERROR_NULL:
+            if (wf->null_branch >= 0) {
+                report_parse_error(plan, wf, word, " written as null");
+                return RECORD_NULL;
+            }
+            // not nullable, skip the row
+            // fall through
+        case ON_ERROR_SKIP:
+            report_parse_error(plan, wf, word, ", row skipped");
+            return RECORD_FAILED;
+
+        case ON_ERROR_FAIL:
+        default:
+            report_parse_error(plan, wf, word, "");
+            return RECORD_ABORT;
+    }
+}
+
+/* set the record from the fields found by next_record() */
+static int build_record(WritePlan *plan)
+{
+    avro_value_t *record = &plan->record;
+
+    avro_value_reset(record);
+
+    for(int i = 0; i < plan->num_fields; i++) {
+        WriteField *wf = &plan->fields[i];
+        avro_value_t value;
+        int rval;
+
+        wf->status = PARSE_OK;
+        if (avro_value_get_by_index(record, wf->index, &value, NULL)
+                || wf->set(&value, wf, &plan->words[i])) {
+            errorPrint(
+                    "%s() LN%d, Unable to set field %s. Message: %s\n",
+                    __func__, __LINE__,
+                    wf->field->name, avro_strerror());
+            return RECORD_FAILED;
+        }
+
+        if ((PARSE_OK != wf->status)
+                && (rval = field_parse_error(plan, wf, &plan->words[i]))) {
+            avro_value_t branch;
+
+            if (RECORD_NULL != rval) {
+                return rval;
+            }
+            if (avro_value_set_branch(&value, wf->null_branch, &branch)
+                    || avro_value_set_null(&branch)) {
+                return RECORD_FAILED;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* the direct path of build_record() and encode_record(): append the
+ * avro binary of the record to buf, or nothing if it fails */
+static int encode_record_direct(WritePlan *plan, char **buf, size_t *cap, size_t *len)
+{
+    size_t need = 0;
+
+    for (int i = 0; i < plan->num_fields; i++) {
+        need += plan->words[i].len + plan->fields[i].encode_bound;
+    }
+    ensure_buffer(buf, cap, *len + need);
+
+    char *start = *buf + *len;
+    char *p = start;
+
+    for (int i = 0; i < plan->num_fields; i++) {
+        WriteField *wf = &plan->fields[i];
+        FieldSlice *word = &plan->words[i];
+        char *field = p;
+        int rval;
+
+        wf->status = PARSE_OK;
+        if (set_nullable_value == wf->set) {
+            if ((!word->quoted) && slice_is(word, "null", 4)) {
+                p += encode_long(p, wf->null_branch);
+                continue;
+            }
+            p += encode_long(p, wf->value_branch);
+        }
+        p = wf->encode(wf, word, p);
+
+        if ((PARSE_OK != wf->status)
+                && (rval = field_parse_error(plan, wf, word))) {
+            if (RECORD_NULL != rval) {
+                return rval;
+            }
+            p = field + encode_long(field, wf->null_branch);
+        }
+    }
+
+    *len += p - start;
+    return 0;
+}
+
+static int write_record_to_file(
+    avro_file_writer_t db,
+    WritePlan *plan)
+{
+    uint64_t t = perf_now();
+    int rval = build_record(plan);
+
+    perf_lap(NULL, PERF_BUILD, &t);
+    if (rval) {
+        return rval;
+    }
+
+    int failed = avro_file_writer_append_value(db, &plan->record);
+    perf_lap(NULL, PERF_ENCODE, &t);
+    if (failed) {
+        errorPrint(
+                "%s() LN%d, Unable to write record to file. Message: %s\n",
+                __func__, __LINE__,
+                avro_strerror());
+        return RECORD_FAILED;
+    }
+
+    return 0;
+}
+
+typedef struct IngestBlock_S {
+    uint64_t    records;
+    size_t      offset;         // in IngestChunk.block
+    size_t      len;
+} IngestBlock;
+
+typedef struct IngestChunk_S {
+    const char  *data;          // whole input lines
+    size_t      data_len;
+    char        *owned;         // copy of the lines when not mapped
+    size_t      owned_cap;
+    char        *encoded;       // avro binary of the records
+    size_t      encoded_len;
+    size_t      encoded_cap;
+    char        *block;         // encoded data after compression
+    size_t      block_len;
+    size_t      block_cap;
+    IngestBlock *blocks;        // container blocks cut from block
+    ColumnStats *stats;         // --stats columns of each block
+    int         num_blocks;
+    int         blocks_cap;
+    uint64_t    records;
+    uint64_t    failed;
+    int         error;
+} IngestChunk;
+
+typedef struct IngestContext_S {
+    FILE            *fp;
+    CodecType       codec;
+    int             level;
+    size_t          block_size;     // 0 for one block per chunk
+    char            sync[AVRO_SYNC_SIZE];
+    WritePlan       **plans;        // one per worker
+    avro_writer_t   *writers;       // one per worker
+    FILE            *stats_fp;      // with --stats
+    StatsColumn     *stats_columns;
+    int             num_stats;
+    ReadPlan        **stats_plans;  // one per worker
+    ColumnStats     **block_stats;  // one per worker, of the block being encoded
+    OrderedPool     *pool;
+    uint64_t        rows;
+    uint64_t        failed;
+    bool            write_failed;
+} IngestContext;
+
+static IngestChunk *new_ingest_chunk(CsvSource *src, const char *data, size_t len)
+{
+    IngestChunk *chunk = calloc(1, sizeof(IngestChunk));
+    assert(chunk);
+
+    if (src->mapped) {
+        chunk->data = data;
+    } else {
+        ensure_buffer(&chunk->owned, &chunk->owned_cap, len);
+        memcpy(chunk->owned, data, len);
+        chunk->data = chunk->owned;
+    }
+    chunk->data_len = len;
+    return chunk;
+}
+
+static void free_ingest_chunk(IngestChunk *chunk)
+{
+    free(chunk->owned);
+    free(chunk->encoded);
+    free(chunk->block);
+    free(chunk->blocks);
+    free(chunk->stats);
+    free(chunk);
+}
+
+static int encode_record(
+        avro_writer_t writer,
+        avro_value_t *record,
+        char **buf, size_t *cap, size_t *len)
+{
+    for (;;) {
+        avro_writer_memory_set_dest(writer, *buf + *len, *cap - *len);
+        int rval = avro_value_write(writer, record);
+        if (0 == rval) {
+            *len += avro_writer_tell(writer);
+            return 0;
+        }
+        if (ENOSPC != rval) {
+            return rval;
+        }
+        ensure_buffer(buf, cap, *cap + 1);
+    }
+}
+
+/* compress the records encoded since start into the next block */
+static int ingest_cut_block(
+        IngestContext *ctx, IngestChunk *chunk,
+        size_t start, uint64_t records, ColumnStats *stats)
+{
+    size_t offset = chunk->block_len;
+
+    if (codec_compress(ctx->codec, ctx->level,
+                chunk->encoded + start, chunk->encoded_len - start,
+                &chunk->block, &chunk->block_cap, &chunk->block_len)) {
+        errorPrint("%s() LN%d, failed to compress block with %s\n",
+                __func__, __LINE__, g_codec_names[ctx->codec]);
+        chunk->error = -1;
+        return -1;
+    }
+
+    if (chunk->num_blocks == chunk->blocks_cap) {
+        chunk->blocks_cap = chunk->blocks_cap?(chunk->blocks_cap * 2):1;
+        chunk->blocks = realloc(chunk->blocks,
+                chunk->blocks_cap * sizeof(IngestBlock));
+        assert(chunk->blocks);
+        if (ctx->num_stats) {
+            chunk->stats = realloc(chunk->stats,
+                    chunk->blocks_cap * ctx->num_stats * sizeof(ColumnStats));
+            assert(chunk->stats);
+        }
+    }
+    if (ctx->num_stats) {
+        memcpy(&chunk->stats[chunk->num_blocks * ctx->num_stats], stats,
+                ctx->num_stats * sizeof(ColumnStats));
+        memset(stats, 0, ctx->num_stats * sizeof(ColumnStats));
+    }
+    chunk->blocks[chunk->num_blocks].records = records;
+    chunk->blocks[chunk->num_blocks].offset = offset;
+    chunk->blocks[chunk->num_blocks].len = chunk->block_len - offset;
+    chunk->num_blocks ++;
+    return 0;
+}
+
+/* worker: parse and encode the lines of one chunk, then compress them
+ * into container blocks of about ctx->block_size */
+static void ingest_encode_chunk(void *job, int thread_idx, void *arg)
+{
+    IngestContext *ctx = arg;
+    IngestChunk *chunk = job;
+    WritePlan *plan = ctx->plans[thread_idx];
+    avro_writer_t writer = ctx->writers[thread_idx];
+    ColumnStats *stats = ctx->num_stats?ctx->block_stats[thread_idx]:NULL;
+    bool direct = plan->direct && (NULL == stats);     // stats read the record
+    const char *p = chunk->data;
+    const char *end = chunk->data + chunk->data_len;
+    size_t block_start = 0;
+    uint64_t block_records = 0;
+    CsvRecord rec;
+    uint64_t times[PERF_NUM_PHASES] = { 0 };
+    uint64_t t = perf_now();
+
+    ensure_buffer(&chunk->encoded, &chunk->encoded_cap, chunk->data_len);
+    if (stats) {
+        memset(stats, 0, ctx->num_stats * sizeof(ColumnStats));
+    }
+
+    while (p < end) {
+        int rval;
+
+        p = next_record(plan, p, end, &rec);
+        perf_lap(times, PERF_TOKENIZE, &t);
+        if (rec.empty) {
+            continue;
+        }
+
+        if (rec.malformed) {
+            chunk->failed ++;
+            continue;
+        }
+
+        if (direct) {
+            rval = encode_record_direct(plan,
+                    &chunk->encoded, &chunk->encoded_cap, &chunk->encoded_len);
+        } else if (0 == (rval = build_record(plan))) {
+            perf_lap(times, PERF_BUILD, &t);
+            if (encode_record(writer, &plan->record,
+                        &chunk->encoded, &chunk->encoded_cap,
+                        &chunk->encoded_len)) {
+                errorPrint(
+                        "%s() LN%d, Unable to encode record. Message: %s\n",
+                        __func__, __LINE__, avro_strerror());
+                rval = RECORD_FAILED;
+            } else if (stats && stats_add_record(ctx->stats_plans[thread_idx],
+                        ctx->stats_columns, ctx->num_stats, stats, &plan->record)) {
+                chunk->error = -1;
+                return;
+            }
+        }
+        perf_lap(times, PERF_ENCODE, &t);
+
+        if (RECORD_ABORT == rval) {
+            chunk->error = -1;
+            return;
+        } else if (rval) {
+            chunk->failed ++;
+        } else {
+            chunk->records ++;
+            block_records ++;
+            if (ctx->block_size
+                    && (chunk->encoded_len - block_start >= ctx->block_size)) {
+                if (ingest_cut_block(ctx, chunk, block_start, block_records, stats)) {
+                    return;
+                }
+                perf_lap(times, PERF_COMPRESS, &t);
+                block_start = chunk->encoded_len;
+                block_records = 0;
+            }
+        }
+    }
+
+    if (block_records > 0) {
+        ingest_cut_block(ctx, chunk, block_start, block_records, stats);
+        perf_lap(times, PERF_COMPRESS, &t);
+    }
+    perf_add_times(times);
+}
+
+static void *ingest_writer_thread(void *arg)
+{
+    IngestContext *ctx = arg;
+    IngestChunk *chunk;
+
+    while (NULL != (chunk = pool_next_done(ctx->pool))) {
+        uint64_t t = perf_now();
+
+        if (ctx->write_failed) {
+            // drain the chunks still in flight
+        } else if (chunk->error) {
+            __atomic_store_n(&ctx->write_failed, true, __ATOMIC_RELEASE);
+        } else {
+            perf_count(chunk->records, chunk->failed, chunk->data_len, chunk->block_len);
+            for (int i = 0; i < chunk->num_blocks; i++) {
+                IngestBlock *b = &chunk->blocks[i];
+                if (write_container_block(ctx->fp, b->records,
+                            chunk->block + b->offset, b->len, ctx->sync)) {
+                    errorPrint("%s() LN%d, failed to write block to %s\n",
+                            __func__, __LINE__, g_args.write_filename);
+                    __atomic_store_n(&ctx->write_failed, true, __ATOMIC_RELEASE);
+                    break;
+                }
+                if (ctx->stats_fp && stats_write_block(ctx->stats_fp, b->records,
+                            &chunk->stats[i * ctx->num_stats], ctx->num_stats)) {
+                    errorPrint("%s() LN%d, failed to write the stats of %s\n",
+                            __func__, __LINE__, g_args.write_filename);
+                    __atomic_store_n(&ctx->write_failed, true, __ATOMIC_RELEASE);
+                    break;
+                }
+            }
+        }
+        perf_lap(NULL, PERF_WRITE, &t);
+        ctx->rows += chunk->records;
+        ctx->failed += chunk->failed;
+        free_ingest_chunk(chunk);
+    }
+
+    return NULL;
+}
+
+/* --append: the new blocks go after the last whole block of the file,
+ * with its sync marker and codec. A tail cut short by a crash is dropped
+ * first; the header and the blocks before it are never written again,
+ * so a crash while appending leaves them readable. A file damaged
+ * anywhere else is left as it is. */
+static int open_for_append(avro_schema_t schema, IngestContext *ctx, uint64_t *blocks)
+{
+    ContainerReader cr;
+    struct stat st;
+    off_t end = 0;
+
+    if (open_container(g_args.write_filename, &cr)) {
+        return -1;
+    }
+    if (!avro_schema_equal(cr.schema, schema)) {
+        errorPrint("The schema of %s differs from %s, can't append\n",
+                g_args.write_filename, g_args.json_filename);
+        close_container(&cr);
+        return -1;
+    }
+    if (cr.codec != ctx->codec) {
+        ctx->codec = cr.codec;
+        ctx->level = (g_args.level >= 0)?g_args.level:codec_default_level(cr.codec);
+    }
+    memcpy(ctx->sync, cr.sync, AVRO_SYNC_SIZE);
+
+    BlockIndex *index = scan_block_index(&cr, &end);
+    close_container(&cr);
+    if (NULL == index) {
+        errorPrint("Unable to walk the blocks of %s, can't append\n", g_args.write_filename);
+        return -1;
+    }
+    *blocks = index->num_blocks;
+    free_block_index(index);
+
+    ctx->fp = fopen(g_args.write_filename, "r+b");
+    if ((NULL == ctx->fp) || fstat(fileno(ctx->fp), &st)) {
+        errorPrint("Unable to open %s to append\n", g_args.write_filename);
+        return -1;
+    }
+    if (st.st_size > end) {
+        warnPrint("%s: dropping %lld bytes after the last whole block\n",
+                g_args.write_filename, (long long)(st.st_size - end));
+    }
+    if (ftruncate(fileno(ctx->fp), end) || fseeko(ctx->fp, end, SEEK_SET)) {
+        errorPrint("Unable to append to %s: %s\n",
+                g_args.write_filename, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int write_avro_file_parallel(
+        avro_schema_t schema,
+        RecordSchema *recordSchema,
+        CsvSource *src,
+        uint64_t *rows,
+        uint64_t *failed)
+{
+    IngestContext ctx;
+    int threads = g_args.threads;
+    int rval = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.codec = codec_from_name(g_args.codec);
+    ctx.level = (g_args.level >= 0)?g_args.level:codec_default_level(ctx.codec);
+    ctx.block_size = g_args.block_size;
+    generate_sync_marker(ctx.sync);
+    verbosePrint("writing %s on %d threads, %s level %d, %zu byte blocks%s\n",
+            g_args.write_filename, threads, g_codec_names[ctx.codec], ctx.level,
+            ctx.block_size?ctx.block_size:INGEST_CHUNK_SIZE,
+            g_args.append?", appending":"");
+
+    if (g_args.stats[0]) {
+        ReadPlan *plan = compile_read_plan(schema, recordSchema);
+        ctx.stats_columns = compile_stats_columns(plan, g_args.stats, &ctx.num_stats);
+        freeReadPlan(plan);
+        if (NULL == ctx.stats_columns) {
+            return -1;
+        }
+    }
+
+    bool append = g_args.append && (!is_stdio(g_args.write_filename))
+        && (0 == access(g_args.write_filename, F_OK));
+    uint64_t blocks = 0;
+
+    if (append) {
+        if (open_for_append(schema, &ctx, &blocks)
+                || stats_prepare_append(g_args.write_filename, ctx.sync, blocks,
+                    ctx.stats_columns, ctx.num_stats, &ctx.stats_fp)) {
+            if (ctx.fp) {
+                fclose(ctx.fp);
+            }
+            free(ctx.stats_columns);
+            return -1;
+        }
+    } else {
+        ctx.fp = is_stdio(g_args.write_filename)?stdout:fopen(g_args.write_filename, "wb");
+        if (NULL == ctx.fp) {
+            errorPrint("There was an error creating %s\n", g_args.write_filename);
+            free(ctx.stats_columns);
+            return -1;
+        }
+
+        if (write_container_header(ctx.fp, schema, ctx.codec, ctx.sync)) {
+            errorPrint("%s() LN%d, failed to write header to %s\n",
+                    __func__, __LINE__, g_args.write_filename);
+            fclose(ctx.fp);
+            free(ctx.stats_columns);
+            return -1;
+        }
+    }
+
+    if (ctx.stats_columns) {
+        char path[PATH_MAX];
+        stats_path(g_args.write_filename, path, sizeof(path));
+        if (NULL == ctx.stats_fp) {
+            ctx.stats_fp = fopen(path, "wb");
+            if ((NULL == ctx.stats_fp) || stats_write_header(ctx.stats_fp,
+                        ctx.sync, ctx.stats_columns, ctx.num_stats)) {
+                errorPrint("There was an error creating %s\n", path);
+                rval = -1;
+            }
+        }
+        ctx.stats_plans = calloc(threads, sizeof(ReadPlan *));
+        ctx.block_stats = calloc(threads, sizeof(ColumnStats *));
+        assert(ctx.stats_plans && ctx.block_stats);
+        for (int t = 0; t < threads; t++) {
+            ctx.stats_plans[t] = compile_read_plan(schema, recordSchema);
+            ctx.block_stats[t] = calloc(ctx.num_stats, sizeof(ColumnStats));
+            assert(ctx.block_stats[t]);
+        }
+    }
+
+    ctx.plans = calloc(threads, sizeof(WritePlan *));
+    ctx.writers = calloc(threads, sizeof(avro_writer_t));
+    assert(ctx.plans && ctx.writers);
+    for (int t = 0; (0 == rval) && (t < threads); t++) {
+        ctx.plans[t] = compile_write_plan(schema, recordSchema);
+        if (NULL == ctx.plans[t]) {
+            rval = -1;
+            break;
+        }
+        ctx.writers[t] = avro_writer_memory(NULL, 0);
+    }
+    if (0 == rval) {
+        verbosePrint("records are encoded %s\n",
+                (ctx.plans[0]->direct && (0 == ctx.num_stats))?
+                "directly from the csv fields":"through avro values");
+    }
+
+    if (0 == rval) {
+        pthread_t writer_thread;
+        ctx.pool = pool_create(threads, ingest_encode_chunk, &ctx);
+        pthread_create(&writer_thread, NULL, ingest_writer_thread, &ctx);
+
+        const char *data;
+        size_t len;
+
+        size_t chunk_size = (g_args.block_size > INGEST_CHUNK_SIZE)?
+            g_args.block_size:INGEST_CHUNK_SIZE;
+
+        while (csv_next_chunk(src, chunk_size, &data, &len)) {
+            if (__atomic_load_n(&ctx.write_failed, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            pool_submit(ctx.pool, new_ingest_chunk(src, data, len));
+        }
+
+        pool_close(ctx.pool);
+        pthread_join(writer_thread, NULL);
+        pool_destroy(ctx.pool);
+
+        if (ctx.write_failed) {
+            rval = -1;
+        }
+    }
+
+    for (int t = 0; t < threads; t++) {
+        freeWritePlan(ctx.plans[t]);
+        if (ctx.writers[t]) {
+            avro_writer_free(ctx.writers[t]);
+        }
+    }
+    free(ctx.plans);
+    free(ctx.writers);
+
+    if (ctx.stats_columns) {
+        for (int t = 0; t < threads; t++) {
+            freeReadPlan(ctx.stats_plans[t]);
+            free(ctx.block_stats[t]);
+        }
+        free(ctx.stats_plans);
+        free(ctx.block_stats);
+        free(ctx.stats_columns);
+    }
+    if (ctx.stats_fp && fclose(ctx.stats_fp)) {
+        errorPrint("%s() LN%d, failed to close the stats of %s\n",
+                __func__, __LINE__, g_args.write_filename);
+        rval = -1;
+    }
+
+    if ((stdout == ctx.fp)?fflush(ctx.fp):fclose(ctx.fp)) {
+        errorPrint("%s() LN%d, failed to close %s\n",
+                __func__, __LINE__, g_args.write_filename);
+        rval = -1;
+    }
+
+    *rows = ctx.rows;
+    *failed = ctx.failed;
+    return rval;
+}
+
+typedef struct CodecTrial_S {
+    CodecType   codec;
+    int         level;
+} CodecTrial;
+
+static const CodecTrial g_codec_trials[] = {
+    { CODEC_NULL,       0 },
+    { CODEC_SNAPPY,     0 },
+    { CODEC_DEFLATE,    1 },
+    { CODEC_DEFLATE,    6 },
+    { CODEC_LZMA,       1 },
+    { CODEC_LZMA,       6 },
+};
+
+static const size_t g_block_size_trials[] = {
+    64*1024, 256*1024, 1024*1024, 4*1024*1024
+};
+
+/* Encode the first AUTO_CODEC_SAMPLE_SIZE bytes of input, compress
+ * them with each codec, level and block size, and keep the smallest
+ * result that compresses at least --auto-codec MB/s, or the fastest
+ * one if none does. The choice goes to g_args. */
+static int auto_select_codec(
+        avro_schema_t schema,
+        RecordSchema *recordSchema,
+        CsvSource *src)
+{
+    IngestContext ctx;
+    WritePlan *plan;
+    avro_writer_t writer;
+    IngestChunk *chunk;
+    const char *data;
+    size_t len;
+
+    if (!csv_next_chunk(src, AUTO_CODEC_SAMPLE_SIZE, &data, &len)) {
+        return 0;
+    }
+    chunk = new_ingest_chunk(src, data, len);
+    csv_unread_chunk(src, len);
+
+    plan = compile_write_plan(schema, recordSchema);
+    if (NULL == plan) {
+        free_ingest_chunk(chunk);
+        return -1;
+    }
+    plan->quiet = true;
+    writer = avro_writer_memory(NULL, 0);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.codec = CODEC_NULL;
+    ctx.plans = &plan;
+    ctx.writers = &writer;
+    ingest_encode_chunk(chunk, 0, &ctx);
+
+    freeWritePlan(plan);
+    avro_writer_free(writer);
+
+    const CodecTrial *best = NULL;
+    size_t best_block_size = 0;
+    size_t best_size = 0;
+    double best_mbps = 0;
+    bool best_fits = false;
+    char *out = NULL;
+    size_t out_cap = 0;
+
+    fprintf(report_stream(), "%zu bytes of avro data from %zu bytes of input:\n",
+            chunk->encoded_len, chunk->data_len);
+
+    for (int c = 0; (chunk->encoded_len > 0)
+            && (c < sizeof(g_codec_trials) / sizeof(g_codec_trials[0])); c++) {
+        const CodecTrial *trial = &g_codec_trials[c];
+
+        for (int b = 0;
+                b < sizeof(g_block_size_trials) / sizeof(g_block_size_trials[0]);
+                b++) {
+            size_t block_size = g_block_size_trials[b];
+            size_t out_len = 0;
+            struct timespec start, end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t off = 0; off < chunk->encoded_len; off += block_size) {
+                size_t n = chunk->encoded_len - off;
+                if (n > block_size) {
+                    n = block_size;
+                }
+                if (codec_compress(trial->codec, trial->level,
+                            chunk->encoded + off, n,
+                            &out, &out_cap, &out_len)) {
+                    errorPrint("%s() LN%d, failed to compress with %s\n",
+                            __func__, __LINE__, g_codec_names[trial->codec]);
+                    out_len = SIZE_MAX;
+                    break;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (SIZE_MAX == out_len) {
+                break;
+            }
+
+            double elapsed = (end.tv_sec - start.tv_sec)
+                + (end.tv_nsec - start.tv_nsec) / 1E9;
+            double mbps = (elapsed > 0)?(chunk->encoded_len / elapsed / 1E6):1E9;
+            bool fits = (mbps >= g_args.auto_codec_mbps);
+
+            fprintf(report_stream(), "  %-8s level %d, block %7zu: %10zu bytes, %8.1f MB/s\n",
+                    g_codec_names[trial->codec], trial->level,
+                    block_size, out_len, mbps);
+
+            if ((NULL == best)
+                    || (fits && !best_fits)
+                    || (fits && (out_len < best_size))
+                    || (!fits && !best_fits && (mbps > best_mbps))) {
+                best = trial;
+                best_block_size = block_size;
+                best_size = out_len;
+                best_mbps = mbps;
+                best_fits = fits;
+            }
+
+            // larger blocks would hold the same single block
+            if (block_size >= chunk->encoded_len) {
+                break;
+            }
+        }
+    }
+
+    free(out);
+    free_ingest_chunk(chunk);
+
+    if (best) {
+        g_args.codec = (char *)g_codec_names[best->codec];
+        g_args.level = best->level;
+        g_args.block_size = best_block_size;
+        fprintf(report_stream(), "auto codec: %s level %d, block size %zu%s\n",
+                g_args.codec, g_args.level, g_args.block_size,
+                best_fits?"":", none reaches the target speed");
+    }
+    return 0;
+}
+
+static int write_avro_file_serial(
+        avro_schema_t schema,
+        RecordSchema *recordSchema,
+        CsvSource *src,
+        uint64_t *rows,
+        uint64_t *failed)
+{
+    avro_file_writer_t db;
+
+    verbosePrint("writing %s with avro's file writer, %s\n",
+            g_args.write_filename, g_args.codec);
+    int rval = avro_file_writer_create_with_codec
+        (g_args.write_filename, schema, &db, g_args.codec, g_args.block_size);
+    if (rval) {
+        errorPrint("There was an error creating %s\n", g_args.write_filename);
+        errorPrint("%s() LN%d, error message: %s\n",
+                __func__, __LINE__,
+                avro_strerror());
+        return -1;
+    }
+
+    WritePlan *plan = compile_write_plan(schema, recordSchema);
+    if (NULL == plan) {
+        avro_file_writer_close(db);
+        return -1;
+    }
+
+    const char *data;
+    size_t len;
+    CsvRecord rec;
+
+    while ((0 == rval) && csv_next_chunk(src, CSV_READ_SIZE, &data, &len)) {
+        const char *p = data;
+        const char *end = data + len;
+        uint64_t chunk_rows = *rows;
+        uint64_t chunk_failed = *failed;
+        uint64_t t = perf_now();
+
+        while (p < end) {
+            p = next_record(plan, p, end, &rec);
+            perf_lap(NULL, PERF_TOKENIZE, &t);
+            if (rec.empty) {
+                continue;
+            }
+            if (rec.malformed) {
+                (*failed) ++;
+            } else if (RECORD_ABORT == (rval = write_record_to_file(db, plan))) {
+                break;
+            } else if (rval) {
+                rval = 0;
+                (*failed) ++;
+            } else {
+                (*rows) ++;
+            }
+            t = perf_now();
+        }
+        perf_count(*rows - chunk_rows, *failed - chunk_failed, len, 0);
+    }
+
+    freeWritePlan(plan);
+    uint64_t t = perf_now();
+    avro_file_writer_close(db);
+    perf_lap(NULL, PERF_WRITE, &t);
+
+    struct stat st;
+    if (0 == stat(g_args.write_filename, &st)) {
+        perf_count(0, 0, 0, st.st_size);
+    }
+    return rval?-1:0;
+}
+
+/* the schema given by -m and its field model */
+static RecordSchema *load_schema_file(const char *path, avro_schema_t *schema)
+{
+    FILE *fp = fopen(path, "r");
+    if (NULL == fp) {
+        errorPrint("Failed to open %s\n", path);
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    int size = ftell(fp);
+
+    char *jsonbuf = calloc(size + 1, 1);
+    assert(jsonbuf);
+    fseek(fp, 0, SEEK_SET);
+    fread(jsonbuf, 1, size, fp);
+    fclose(fp);
+
+    if (g_args.debug_output) {
+        fprintf(report_stream(), "%s() LN%d\n === json content:\n%s\n",
+                __func__, __LINE__, jsonbuf);
+    }
+
+    if (avro_schema_from_json_length(jsonbuf, strlen(jsonbuf), schema)) {
         errorPrint("%s", "Unable to parse schema\n");
         errorPrint("%s() LN%d, error message: %s\n",
                 __func__, __LINE__, avro_strerror());
-        fclose(fp);
         free(jsonbuf);
-        return -1;
+        return NULL;
     }
 
     if (g_args.debug_output) {
-        avro_writer_t stdout_writer = avro_writer_file_fp(stdout, 1);
-        printf("=== convert Schema back to json:\n");
-        avro_schema_to_json(schema, stdout_writer);
-        printf("\n");
+        avro_writer_t stdout_writer = avro_writer_file_fp(report_stream(), 0);
+        fprintf(report_stream(), "=== convert Schema back to json:\n");
+        avro_schema_to_json(*schema, stdout_writer);
+        fprintf(report_stream(), "\n");
         avro_writer_free(stdout_writer);
     }
 
-    json_t *json_root = load_json(jsonbuf);
+    RecordSchema *recordSchema = recordschema_from_json_text(
+            *schema, jsonbuf, size);
     free(jsonbuf);
 
-    RecordSchema *recordSchema;
+    if (NULL == recordSchema) {
+        avro_schema_decref(*schema);
+        errorPrint("%s", "Failed to build the field model of the schema\n");
+    }
+    return recordSchema;
+}
+
+static int write_avro_file()
+{
+    avro_schema_t schema;
+    uint64_t t = perf_now();
+    RecordSchema *recordSchema = load_schema_file(g_args.json_filename, &schema);
+    perf_lap(NULL, PERF_SCHEMA, &t);
+    if (NULL == recordSchema) {
+        return -1;
+    }
 
-    if (json_root) {
-        if (g_args.debug_output) {
-            print_json(json_root);
-        }
+    if (is_stdio(g_args.write_filename) && g_args.stats[0]) {
+        errorPrint("%s", "--stats needs a file to write, not stdout\n");
+        avro_schema_decref(schema);
+        freeRecordSchema(recordSchema);
+        return -1;
+    }
+    if ((!is_stdio(g_args.write_filename)) && (!g_args.append)) {
+        char stats_file[PATH_MAX];
+        stats_path(g_args.write_filename, stats_file, sizeof(stats_file));
+        remove(g_args.write_filename);
+        remove(stats_file);
+    }
+
+    CsvSource src;
+    if (csv_open(g_args.data_filename, &src)) {
+        freeRecordSchema(recordSchema);
+        errorPrint("Failed to open %s\n", g_args.data_filename);
+        exit(EXIT_FAILURE);
+    }
 
-        recordSchema = parse_json_to_recordschema(json_root);
+    uint64_t rows = 0;
+    uint64_t failed = 0;
+    struct timespec start, end;
+    int rval = 0;
 
-        if (NULL == recordSchema) {
-            fclose(fp);
-            errorPrint("%s", "Failed to parse json to recordschema\n");
-            exit(EXIT_FAILURE);
-        }
+    if (g_args.auto_codec) {
+        rval = auto_select_codec(schema, recordSchema, &src);
+    }
 
-        json_decref(json_root);
+    /* schemas the direct encoder writes skip avro's own file writer too */
+    WritePlan *plan = rval?NULL:compile_write_plan(schema, recordSchema);
+    bool direct = plan && plan->direct && (!g_args.stats[0]);
+    rval = plan?0:-1;
+    freeWritePlan(plan);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (rval) {
+        // no plan for the schema, already reported
+    } else if ((g_args.threads > 1) || (g_args.level >= 0) || g_args.stats[0]
+            || is_stdio(g_args.write_filename) || g_args.append || direct) {
+        // avro's own file writer has no compression level, block stats,
+        // stdout, appending with a check of the tail or direct encoding
+        rval = write_avro_file_parallel(schema, recordSchema, &src,
+                &rows, &failed);
     } else {
-        fclose(fp);
-        errorPrint("%s", "json can't be parsed by jansson\n");
-        exit(EXIT_FAILURE);
+        rval = write_avro_file_serial(schema, recordSchema, &src,
+                &rows, &failed);
     }
 
-    remove(g_args.write_filename);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1E9;
 
-    avro_file_writer_t db;
+    avro_schema_decref(schema);
+    freeRecordSchema(recordSchema);
+
+    csv_close(&src);
 
-    int rval = avro_file_writer_create_with_codec
-        (g_args.write_filename, schema, &db, QUICKSTOP_CODEC, 0);
     if (rval) {
-        avro_schema_decref(schema);
-        freeRecordSchema(recordSchema);
-        fclose(fp);
-        errorPrint("There was an error creating %s\n", g_args.write_filename);
-        errorPrint("%s() LN%d, error message: %s\n",
-                __func__, __LINE__,
-                avro_strerror());
-        return -1;
+        return rval;
     }
 
-    FILE *fd = fopen(g_args.data_filename, "r");
-    if (NULL == fd) {
-        freeRecordSchema(recordSchema);
+    okPrint("%"PRIu64" rows written in %.3f seconds, %.0f rows/s\n",
+            rows, elapsed, (elapsed > 0)?(rows / elapsed):0);
+    if (failed) {
+        warnPrint("%"PRIu64" rows failed to write\n", failed);
+    }
+    return 0;
+}
+
+#define BENCH_CSV_MAX_FIELDS    64
+#define BENCH_CSV_ROUNDS        5
+
+static double bench_elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec)
+        + (end.tv_nsec - start->tv_nsec) / 1E9;
+}
+
+static void bench_report(const char *name, size_t bytes,
+        uint64_t fields, double elapsed)
+{
+    printf("%-10s %10.1f MB/s  %"PRIu64" fields\n", name,
+            (elapsed > 0)?(bytes * BENCH_CSV_ROUNDS / elapsed / 1E6):0,
+            fields);
+}
+
+/* compare the tokenizer with the getline() + strsep() loop
+ * it replaced, on the file given by -d */
+static int bench_csv(void)
+{
+    CsvSource src;
+    const char *data;
+    size_t size;
+
+    if (csv_open(g_args.data_filename, &src)) {
         errorPrint("Failed to open %s\n", g_args.data_filename);
-        fclose(fp);
-        exit(EXIT_FAILURE);
+        return -1;
+    }
+    while (!src.eof) {
+        csv_fill(&src, src.size + CSV_READ_SIZE);
+    }
+    data = src.data;
+    size = src.size;
+    printf("%s: %zu bytes, %d rounds\n",
+            g_args.data_filename, size, BENCH_CSV_ROUNDS);
+
+    struct timespec start;
+    uint64_t fields = 0;
+    char *copy = NULL;
+    size_t copy_cap = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < BENCH_CSV_ROUNDS; r++) {
+        const char *p = data;
+        const char *end = data + size;
+
+        fields = 0;
+        while (p < end) {
+            const char *nl = memchr(p, '\n', end - p);
+            size_t len = nl?(size_t)(nl - p):(size_t)(end - p);
+
+            ensure_buffer(&copy, &copy_cap, len + 1);
+            memcpy(copy, p, len);
+            copy[len] = '\0';
+            p += len + 1;
+
+            char *line = copy;
+            while (strsep(&line, ",")) {
+                fields ++;
+            }
+        }
+    }
+    bench_report("strsep", size, fields, bench_elapsed(&start));
+    free(copy);
+
+    FieldSlice *words = calloc(BENCH_CSV_MAX_FIELDS, sizeof(FieldSlice));
+    assert(words);
+    CsvTokenizer tok;
+    csv_tokenizer_init(&tok);
+
+    for (int i = 0; i < CSV_NUM_CLASSIFIERS; i++) {
+        if (!csv_classifier_supported(&g_csv_classifiers[i])) {
+            continue;
+        }
+        tok.classify = g_csv_classifiers[i].classify;
+
+        CsvRecord rec;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < BENCH_CSV_ROUNDS; r++) {
+            const char *p = data;
+            const char *end = data + size;
+
+            fields = 0;
+            while (p < end) {
+                p = csv_tokenize(&tok, p, end,
+                        words, BENCH_CSV_MAX_FIELDS, &rec);
+                fields += rec.fields;
+            }
+        }
+        bench_report(g_csv_classifiers[i].name, size, fields,
+                bench_elapsed(&start));
+    }
+
+    csv_tokenizer_free(&tok);
+    free(words);
+    csv_close(&src);
+    return 0;
+}
+
+/* rows made up for --bench: a fixed seed, so every run writes the same data */
+typedef struct BenchGen_S {
+    uint64_t    state;
+    char        *buf;
+    size_t      len;
+    size_t      cap;
+} BenchGen;
+
+static uint64_t bench_rand(BenchGen *gen)
+{
+    gen->state ^= gen->state << 13;
+    gen->state ^= gen->state >> 7;
+    gen->state ^= gen->state << 17;
+    return gen->state;
+}
+
+/* uniform from 0 to 2 * mean, so the average is mean */
+static uint64_t bench_rand_len(BenchGen *gen, int mean)
+{
+    return (mean > 0)?(bench_rand(gen) % (2 * (uint64_t)mean + 1)):0;
+}
+
+static bool bench_is_null(BenchGen *gen)
+{
+    return (bench_rand(gen) >> 11) * (1.0 / 9007199254740992.0) < g_args.bench_nulls;
+}
+
+static void bench_append(BenchGen *gen, const char *p, size_t len)
+{
+    ensure_buffer(&gen->buf, &gen->cap, gen->len + len + 1);
+    memcpy(gen->buf + gen->len, p, len);
+    gen->len += len;
+}
+
+static void bench_append_str(BenchGen *gen, const char *s)
+{
+    bench_append(gen, s, strlen(s));
+}
+
+/* numbers only, names and symbols go through bench_append_str() */
+static void bench_printf(BenchGen *gen, const char *fmt, ...)
+{
+    char text[64];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    assert((len >= 0) && ((size_t)len < sizeof(text)));
+    bench_append(gen, text, len);
+}
+
+/* letters and digits only, so nothing needs quoting in csv or json */
+static void bench_text(BenchGen *gen, size_t len)
+{
+    static const char alnum[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+    ensure_buffer(&gen->buf, &gen->cap, gen->len + len + 1);
+    for (size_t i = 0; i < len; i++) {
+        gen->buf[gen->len++] = alnum[bench_rand(gen) % (sizeof(alnum) - 1)];
     }
+}
+
+/* a value of any schema as the json set_json_value() takes */
+static void bench_json_value(BenchGen *gen, avro_schema_t schema)
+{
+    schema = resolve_link(schema);
 
-    ssize_t n = 0;
-    ssize_t readLen = 0;
-    char *line = NULL;
+    switch (avro_typeof(schema)) {
+        case AVRO_NULL:
+            bench_append(gen, "null", 4);
+            break;
+        case AVRO_BOOLEAN:
+            bench_append_str(gen, (bench_rand(gen) & 1)?"true":"false");
+            break;
+        case AVRO_INT32:
+            bench_printf(gen, "%d", (int32_t)(bench_rand(gen) % 2000001) - 1000000);
+            break;
+        case AVRO_INT64:
+            bench_printf(gen, "%"PRId64, (int64_t)(bench_rand(gen) >> 24) - (1LL << 39));
+            break;
+        case AVRO_FLOAT:
+        case AVRO_DOUBLE:
+            bench_printf(gen, "%.3f", (int64_t)(bench_rand(gen) % 2000001 - 1000000) / 1000.0);
+            break;
+        case AVRO_STRING:
+        case AVRO_BYTES:
+            bench_append(gen, "\"", 1);
+            bench_text(gen, bench_rand_len(gen, g_args.bench_string_len));
+            bench_append(gen, "\"", 1);
+            break;
+        case AVRO_FIXED:
+            bench_append(gen, "\"", 1);
+            bench_text(gen, avro_schema_fixed_size(schema));
+            bench_append(gen, "\"", 1);
+            break;
+        case AVRO_ENUM: {
+            const char *symbol = avro_schema_enum_get(schema,
+                    bench_rand(gen) % avro_schema_enum_number_of_symbols(schema));
+            bench_append(gen, "\"", 1);
+            bench_append_str(gen, symbol);
+            bench_append(gen, "\"", 1);
+            break;
+        }
+        case AVRO_ARRAY: {
+            uint64_t items = bench_rand_len(gen, g_args.bench_array_len);
+            bench_append(gen, "[", 1);
+            for (uint64_t i = 0; i < items; i++) {
+                if (i) {
+                    bench_append(gen, ",", 1);
+                }
+                bench_json_value(gen, avro_schema_array_items(schema));
+            }
+            bench_append(gen, "]", 1);
+            break;
+        }
+        case AVRO_MAP: {
+            uint64_t items = bench_rand_len(gen, g_args.bench_array_len);
+            bench_append(gen, "{", 1);
+            for (uint64_t i = 0; i < items; i++) {
+                bench_printf(gen, "%s\"k%"PRIu64"\":", i?",":"", i);
+                bench_json_value(gen, avro_schema_map_values(schema));
+            }
+            bench_append(gen, "}", 1);
+            break;
+        }
+        case AVRO_RECORD: {
+            size_t fields = avro_schema_record_size(schema);
+            bench_append(gen, "{", 1);
+            for (size_t i = 0; i < fields; i++) {
+                bench_append_str(gen, i?",\"":"\"");
+                bench_append_str(gen, avro_schema_record_field_name(schema, i));
+                bench_append(gen, "\":", 2);
+                bench_json_value(gen,
+                        avro_schema_record_field_get_by_index(schema, i));
+            }
+            bench_append(gen, "}", 1);
+            break;
+        }
+        case AVRO_UNION: {
+            // null at the --bench-nulls ratio, else any other branch
+            size_t branches = avro_schema_union_size(schema);
+            avro_schema_t values[branches];
+            size_t num_values = 0;
+            for (size_t i = 0; i < branches; i++) {
+                avro_schema_t branch = avro_schema_union_branch(schema, i);
+                if (AVRO_NULL != avro_typeof(branch)) {
+                    values[num_values++] = branch;
+                }
+            }
+            if ((0 == num_values)
+                    || ((num_values < branches) && bench_is_null(gen))) {
+                bench_append(gen, "null", 4);
+            } else {
+                bench_json_value(gen, values[bench_rand(gen) % num_values]);
+            }
+            break;
+        }
+        default:
+            bench_append(gen, "null", 4);
+            break;
+    }
+}
 
-    fseek(fd, 0, SEEK_SET);
+/* a csv field as the setter of its field type takes it */
+static void bench_field(BenchGen *gen, FieldStruct *field)
+{
+    FieldSetter setter = get_field_setter(field);
+
+    if (field->nullable && bench_is_null(gen)) {
+        bench_append(gen, "null", 4);
+    } else if (set_temporal_value == setter) {
+        // 2020-01-01 and three years on, in the unit of the logical type
+        int64_t days = 18262 + bench_rand(gen) % 1096;
+        int64_t ms = bench_rand(gen) % 86400000;
+        const char *logical = field->logical_type;
+
+        if (0 == strcmp(logical, "date")) {
+            bench_printf(gen, "%"PRId64, days);
+        } else if (0 == strcmp(logical, "time-millis")) {
+            bench_printf(gen, "%"PRId64, ms);
+        } else if (0 == strcmp(logical, "time-micros")) {
+            bench_printf(gen, "%"PRId64, ms * 1000);
+        } else {
+            int64_t t = days * 86400000 + ms;
+            bench_printf(gen, "%"PRId64, strstr(logical, "micros")?(t * 1000):t);
+        }
+    } else if (set_decimal_value == setter) {
+        int digits = field->precision - field->scale;
+        uint64_t whole = bench_rand(gen) % 1000000000;
+        for (int i = digits; i < 9; i++) {
+            whole /= 10;
+        }
+        bench_printf(gen, "%s%"PRIu64, (bench_rand(gen) & 1)?"-":"", whole);
+        if (field->scale > 0) {
+            bench_append(gen, ".", 1);
+            for (int i = 0; i < field->scale; i++) {
+                bench_printf(gen, "%d", (int)(bench_rand(gen) % 10));
+            }
+        }
+    } else if ((set_string_value == setter) || (set_bytes_value == setter)) {
+        bench_text(gen, bench_rand_len(gen, g_args.bench_string_len));
+    } else if (set_fixed_value == setter) {
+        bench_text(gen, avro_schema_fixed_size(field->schema));
+    } else if (set_enum_value == setter) {
+        bench_append_str(gen, avro_schema_enum_get(field->schema,
+                    bench_rand(gen) % avro_schema_enum_number_of_symbols(field->schema)));
+    } else if ((set_int_array_value == setter) || (set_long_array_value == setter)) {
+        bench_printf(gen, "%"PRIu64, bench_rand(gen)
+                % ((set_int_array_value == setter)?UINT32_MAX:UINT64_MAX));
+    } else if (set_json_value == setter) {
+        // json has double quotes and commas, quote it with '
+        bench_append(gen, "'", 1);
+        bench_json_value(gen, field->schema);
+        bench_append(gen, "'", 1);
+    } else {
+        bench_json_value(gen, field->schema);
+    }
+}
 
-    while(-1 != readLen) {
-        readLen = getline(&line, &n, fd);
+/* --bench rows of the schema into a csv file, returns its size */
+static int64_t bench_make_csv(RecordSchema *recordSchema, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    BenchGen gen = { 0x9E3779B97F4A7C15ULL, NULL, 0, 0 };
+    int64_t bytes = 0;
 
-        if (readLen != -1) {
-            if (g_args.debug_output) {
-                printf("%s", line);
+    if (NULL == fp) {
+        errorPrint("Failed to create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    for (uint64_t row = 0; row < g_args.bench_rows; row++) {
+        for (int i = 0; i < recordSchema->num_fields; i++) {
+            FieldStruct *field = (FieldStruct *)(recordSchema->fields
+                    + sizeof(FieldStruct) * i);
+            if (i) {
+                bench_append(&gen, ",", 1);
+            }
+            bench_field(&gen, field);
+        }
+        bench_append(&gen, "\n", 1);
+        if ((gen.len >= CSV_READ_SIZE) || (row + 1 == g_args.bench_rows)) {
+            if (gen.len != fwrite(gen.buf, 1, gen.len, fp)) {
+                errorPrint("Failed to write %s: %s\n", path, strerror(errno));
+                bytes = -1;
+                break;
             }
-            write_record_to_file(db, line, &schema, recordSchema);
+            bytes += gen.len;
+            gen.len = 0;
+        }
+    }
+    free(gen.buf);
+    if (fclose(fp)) {
+        return -1;
+    }
+    return bytes;
+}
+
+/* run one pass of the tool in a child, so its peak rss is its own */
+static int bench_run(bool read, double *elapsed, long *max_rss_kb)
+{
+    struct timespec start;
+    struct rusage usage;
+    int status;
+
+    fflush(stdout);
+    fflush(stderr);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        errorPrint("%s() LN%d, fork failed: %s\n", __func__, __LINE__, strerror(errno));
+        return -1;
+    } else if (0 == pid) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
         }
+        _exit((0 == (read?read_avro_file():write_avro_file()))?EXIT_SUCCESS:EXIT_FAILURE);
+    }
+
+    if ((pid != wait4(pid, &status, 0, &usage))
+            || (!WIFEXITED(status)) || (EXIT_SUCCESS != WEXITSTATUS(status))) {
+        return -1;
     }
+    *elapsed = bench_elapsed(&start);
+    *max_rss_kb = usage.ru_maxrss;
+    return 0;
+}
 
+/* --bench: write the made up csv with each codec, level and block size,
+ * --codec and --block-size narrowing the sweep, and read it back. One
+ * json line per run goes to stdout. */
+static int bench_avro(void)
+{
+    char dir[PATH_MAX];
+    char csv_path[PATH_MAX];
+    char avro_path[PATH_MAX];
+    char side_path[PATH_MAX];
+    const char *tmp = getenv("TMPDIR");
+    avro_schema_t schema;
+    int rval = 0;
+
+    if (!g_args.json_filename[0]) {
+        errorPrint("%s", "--bench needs the schema given by -m\n");
+        return -1;
+    }
+    RecordSchema *recordSchema = load_schema_file(g_args.json_filename, &schema);
+    if (NULL == recordSchema) {
+        return -1;
+    }
+    for (int i = 0; i < recordSchema->num_fields; i++) {
+        FieldStruct *field = (FieldStruct *)(recordSchema->fields
+                + sizeof(FieldStruct) * i);
+        if (NULL == get_field_setter(field)) {
+            errorPrint("%s() LN%d, no values to make up for field %s of type %s\n",
+                    __func__, __LINE__, field->name, field->type);
+            rval = -1;
+        }
+    }
     avro_schema_decref(schema);
 
-    free(line);
+    snprintf(dir, sizeof(dir), "%s/avrotool-bench-XXXXXX", (tmp && tmp[0])?tmp:"/tmp");
+    if ((0 == rval) && (NULL == mkdtemp(dir))) {
+        errorPrint("Failed to create %s: %s\n", dir, strerror(errno));
+        rval = -1;
+    }
+    if (rval) {
+        freeRecordSchema(recordSchema);
+        return -1;
+    }
+    snprintf(csv_path, sizeof(csv_path), "%s/data.csv", dir);
+    snprintf(avro_path, sizeof(avro_path), "%s/data.avro", dir);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t csv_bytes = bench_make_csv(recordSchema, csv_path);
     freeRecordSchema(recordSchema);
+    if (csv_bytes < 0) {
+        rval = -1;
+    } else {
+        okPrint("%"PRIu64" rows, %"PRId64" bytes of csv made up in %.3f seconds\n",
+                g_args.bench_rows, csv_bytes, bench_elapsed(&start));
+    }
 
-    fclose(fd);
-    fclose(fp);
+    const CodecTrial *trials = g_codec_trials;
+    const size_t *sizes = g_block_size_trials;
+    int num_trials = sizeof(g_codec_trials) / sizeof(g_codec_trials[0]);
+    int num_sizes = sizeof(g_block_size_trials) / sizeof(g_block_size_trials[0]);
+    CodecTrial given_trial;
+
+    if (g_args.codec_given) {
+        given_trial.codec = codec_from_name(g_args.codec);
+        given_trial.level = (g_args.level >= 0)?g_args.level
+            :codec_default_level(given_trial.codec);
+        trials = &given_trial;
+        num_trials = 1;
+    }
+    if (g_args.block_size) {
+        sizes = &g_args.block_size;
+        num_sizes = 1;
+    }
 
-    avro_file_writer_close(db);
-    return 0;
+    g_args.data_filename = csv_path;
+    g_args.write_filename = avro_path;
+    g_args.read_filename = avro_path;
+    g_args.output_filename = "";
+    g_args.stats = "";
+    g_args.append = false;
+    g_args.auto_codec = false;
+
+    // the schema path as a json string, for the result lines
+    OutBuf schema_name;
+    out_init(&schema_name, FORMAT_JSONL, -1);
+    out_json_text(&schema_name, g_args.json_filename, strlen(g_args.json_filename), false);
+    out_char(&schema_name, '\0');
+
+    for (int t = 0; (0 == rval) && (t < num_trials); t++) {
+        for (int b = 0; (0 == rval) && (b < num_sizes); b++) {
+            g_args.codec = (char *)g_codec_names[trials[t].codec];
+            g_args.level = trials[t].level;
+            g_args.block_size = sizes[b];
+
+            double write_s, read_s;
+            long write_rss, read_rss;
+            struct stat st;
+
+            if (bench_run(false, &write_s, &write_rss)
+                    || stat(avro_path, &st)
+                    || bench_run(true, &read_s, &read_rss)) {
+                errorPrint("%s() LN%d, bench of %s level %d with %zu byte blocks failed\n",
+                        __func__, __LINE__, g_args.codec, g_args.level, g_args.block_size);
+                rval = -1;
+                break;
+            }
+            printf("{\"schema\":%s,\"rows\":%"PRIu64",\"csv_bytes\":%"PRId64","
+                    "\"codec\":\"%s\",\"level\":%d,\"block_size\":%zu,\"threads\":%d,"
+                    "\"avro_bytes\":%"PRId64","
+                    "\"write_seconds\":%.6f,\"write_rows_per_second\":%.0f,"
+                    "\"write_mb_per_second\":%.2f,\"write_max_rss_kb\":%ld,"
+                    "\"read_seconds\":%.6f,\"read_rows_per_second\":%.0f,"
+                    "\"read_mb_per_second\":%.2f,\"read_max_rss_kb\":%ld}\n",
+                    schema_name.buf, g_args.bench_rows, csv_bytes,
+                    g_args.codec, g_args.level, g_args.block_size, g_args.threads,
+                    (int64_t)st.st_size,
+                    write_s, (write_s > 0)?(g_args.bench_rows / write_s):0,
+                    (write_s > 0)?(csv_bytes / write_s / 1E6):0, write_rss,
+                    read_s, (read_s > 0)?(g_args.bench_rows / read_s):0,
+                    (read_s > 0)?(csv_bytes / read_s / 1E6):0, read_rss);
+            fflush(stdout);
+        }
+    }
+    out_free(&schema_name);
+
+    remove(csv_path);
+    remove(avro_path);
+    snprintf(side_path, sizeof(side_path), "%s.idx", avro_path);
+    remove(side_path);
+    stats_path(avro_path, side_path, sizeof(side_path));
+    remove(side_path);
+    rmdir(dir);
+    return rval;
+}
+
+static pthread_mutex_t g_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_progress_cond;   // on CLOCK_MONOTONIC, see main()
+static bool g_progress_done;
+
+static void perf_print_counters(const char *what, double elapsed)
+{
+    uint64_t rows = __atomic_load_n(&g_perf.rows, __ATOMIC_RELAXED);
+
+    performancePrint("%s %.1f s: %"PRIu64" rows, %"PRIu64" errors, %.1f MB in,"
+            " %.1f MB out, %.0f rows/s\n", what, elapsed, rows,
+            __atomic_load_n(&g_perf.errors, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_perf.bytes_in, __ATOMIC_RELAXED) / 1E6,
+            __atomic_load_n(&g_perf.bytes_out, __ATOMIC_RELAXED) / 1E6,
+            (elapsed > 0)?(rows / elapsed):0);
+}
+
+/* --progress: a line to stderr every interval until the command ends */
+static void *progress_thread(void *arg)
+{
+    struct timespec *start = arg;
+    struct timespec deadline = *start;
+
+    pthread_mutex_lock(&g_progress_lock);
+    while (!g_progress_done) {
+        deadline.tv_sec += g_args.progress_interval;
+        while ((!g_progress_done) && (ETIMEDOUT != pthread_cond_timedwait(
+                        &g_progress_cond, &g_progress_lock, &deadline))) {
+        }
+        if (!g_progress_done) {
+            perf_print_counters("progress", bench_elapsed(start));
+        }
+    }
+    pthread_mutex_unlock(&g_progress_lock);
+    return NULL;
+}
+
+/* --perf: phase times are summed over the threads, so with -j they add
+ * up to more than the wall time */
+static void perf_report(double elapsed)
+{
+    struct rusage usage;
+
+    for (int i = 0; i < PERF_NUM_PHASES; i++) {
+        if (g_perf.ns[i]) {
+            performancePrint("%-14s %10.3f s\n", g_perf_phase_names[i], g_perf.ns[i] / 1E9);
+        }
+    }
+    perf_print_counters("total", elapsed);
+    if (0 == getrusage(RUSAGE_SELF, &usage)) {
+        performancePrint("peak rss %ld KB\n", usage.ru_maxrss);
+    }
 }
 
 int main(int argc, char **argv) {
@@ -1042,7 +8840,57 @@ int main(int argc, char **argv) {
         exit(0);
     }
 
-    if (g_args.read_file || g_args.schema_only) {
+    json_set_alloc_funcs(json_arena_malloc, json_arena_free);
+
+    struct timespec start;
+    pthread_t progress;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (g_args.progress_interval) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&g_progress_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_create(&progress, NULL, progress_thread, &start);
+    }
+
+    if (g_args.bench_rows) {
+        if (0 == bench_avro()) {
+            okPrint("%s", "Success!\n");
+        } else {
+            errorPrint("%s", "Failed!\n");
+        }
+    } else if (g_args.bench_csv) {
+        if (0 == bench_csv()) {
+            okPrint("%s", "Success!\n");
+        } else {
+            errorPrint("%s", "Failed!\n");
+        }
+    } else if (g_args.recompress_input[0]) {
+        if (0 == recompress_avro_file()) {
+            okPrint("%s", "Success!\n");
+        } else {
+            errorPrint("%s", "Failed!\n");
+        }
+    } else if (g_args.split_filename[0]) {
+        if (0 == split_avro_file()) {
+            okPrint("%s", "Success!\n");
+        } else {
+            errorPrint("%s", "Failed!\n");
+        }
+    } else if (g_args.num_concat_inputs > 0) {
+        if (0 == concat_avro_files()) {
+            okPrint("%s", "Success!\n");
+        } else {
+            errorPrint("%s", "Failed!\n");
+        }
+    } else if (g_args.inspect) {
+        if (0 == inspect_avro_file()) {
+            okPrint("%s", "Success!\n");
+        } else {
+            errorPrint("%s", "Failed!\n");
+        }
+    } else if (g_args.read_file || g_args.schema_only) {
         if (0 == read_avro_file()) {
             okPrint("%s", "Success!\n");
         } else {
@@ -1056,6 +8904,17 @@ int main(int argc, char **argv) {
         }
     }
     fflush(stdout);
+
+    if (g_args.progress_interval) {
+        pthread_mutex_lock(&g_progress_lock);
+        g_progress_done = true;
+        pthread_cond_signal(&g_progress_cond);
+        pthread_mutex_unlock(&g_progress_lock);
+        pthread_join(progress, NULL);
+    }
+    if (g_args.performance_print) {
+        perf_report(bench_elapsed(&start));
+    }
     exit(EXIT_SUCCESS);
 }
 